@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# Remote zip files over http range requests.
+# Serves a generated corpus with a local stand-in http server, checks the catalog made from urls
+# is the same as from local files and reports how much of the zip files was downloaded.
+#
+#   http_range.py --cem-tool <exe> --probe-command <probe-stub>
+#   http_range.py --serve <dir> [--port <n>]    (only serve a directory)
+
+import argparse
+import http.server
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+
+from run_benchmark import generate_corpus
+
+
+# Single "bytes=a-b", "bytes=a-" or "bytes=-n" range, like most static file servers.
+class range_handler(http.server.SimpleHTTPRequestHandler):
+    bytes_sent = 0
+    requests = 0
+    lock = threading.Lock()
+
+    def do_GET(self):
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+
+        size = os.path.getsize(path)
+        match = re.fullmatch(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+
+        if not match or match.groups() == ("", ""):
+            self.send_error(400, "Range header required")
+            return
+
+        first, last = match.groups()
+        if first == "":
+            first, last = max(size - int(last), 0), size - 1
+        else:
+            first, last = int(first), min(int(last), size - 1) if last else size - 1
+
+        if first >= size or first > last:
+            self.send_response(416)
+            self.send_header("Content-Range", "bytes */%d" % size)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        with open(path, "rb") as f:
+            f.seek(first)
+            data = f.read(last - first + 1)
+
+        self.send_response(206)
+        self.send_header("Content-Range", "bytes %d-%d/%d" % (first, last, size))
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+        with range_handler.lock:
+            range_handler.bytes_sent += len(data)
+            range_handler.requests += 1
+
+    def log_message(self, format, *args):
+        pass
+
+
+def start_server(directory, port):
+    handler = lambda *args, **kwargs: range_handler(*args, directory=directory, **kwargs)
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", port), handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def run_catalog(args, run_directory, inputs):
+    catalog_path = os.path.join(run_directory, "catalog.json")
+    command = [args.cem_tool, "--yes", "--probe-command", args.probe_command, "--catalog", catalog_path] + inputs
+    result = subprocess.run(command, cwd=run_directory, stdout=subprocess.DEVNULL)
+
+    if result.returncode != 0:
+        sys.exit("cem-tool failed with exit code %d." % result.returncode)
+
+    with open(catalog_path, "rb") as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Remote zip files over http range requests.")
+    parser.add_argument("--cem-tool", help="cem-tool executable")
+    parser.add_argument("--probe-command", help="probe stub executable")
+    parser.add_argument("--count", type=int, default=20, help="number of zip files in corpus (default: 20)")
+    parser.add_argument("--seed", type=int, default=1, help="corpus seed (default: 1)")
+    parser.add_argument("--max-share", type=float, default=0.5, help="fail if more of the corpus is downloaded (default: 0.5)")
+    parser.add_argument("--serve", metavar="DIR", help="only serve a directory until interrupted")
+    parser.add_argument("--port", type=int, default=0, help="server port (default: any free port)")
+    args = parser.parse_args()
+
+    if args.serve:
+        server = start_server(os.path.abspath(args.serve), args.port)
+        print("Serving '%s' on http://127.0.0.1:%d/" % (args.serve, server.server_address[1]))
+        threading.Event().wait()
+        return 0
+
+    if not args.cem_tool or not args.probe_command:
+        parser.error("--cem-tool and --probe-command are required")
+
+    args.cem_tool = os.path.abspath(args.cem_tool)
+    args.probe_command = os.path.abspath(args.probe_command)
+
+    corpus_directory = tempfile.mkdtemp(prefix="cem-tool-corpus-")
+    run_directory = tempfile.mkdtemp(prefix="cem-tool-http-")
+    try:
+        corpus_size = generate_corpus(corpus_directory, args.count, args.seed)
+        names = sorted(os.listdir(corpus_directory))
+
+        local = run_catalog(args, run_directory, [os.path.join(corpus_directory, n) for n in names])
+
+        server = start_server(corpus_directory, args.port)
+        base_url = "http://127.0.0.1:%d/" % server.server_address[1]
+        remote = run_catalog(args, run_directory, [base_url + n for n in names])
+        server.shutdown()
+    finally:
+        shutil.rmtree(corpus_directory, ignore_errors=True)
+        shutil.rmtree(run_directory, ignore_errors=True)
+
+    share = range_handler.bytes_sent / corpus_size
+    print("Downloaded %d of %d bytes (%.1f%%) in %d range requests." % (range_handler.bytes_sent, corpus_size, share * 100, range_handler.requests))
+
+    if local != remote:
+        print("Catalog from urls is different from catalog from local files.")
+        return 1
+
+    if share > args.max_share:
+        print("Downloaded more than %.0f%% of the corpus." % (args.max_share * 100))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
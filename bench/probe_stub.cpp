@@ -0,0 +1,25 @@
+// Stands in for 'cem-tool probe [--run-infos] <mfx file>' in benchmarks, extensions cant be loaded outside 32bit windows.
+// Prints the same json with infos made up from the mfx file name.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+
+
+int main(int argc, char** argv) {
+    bool run_infos = argc == 4 && std::strcmp(argv[2], "--run-infos") == 0;
+
+    if(argc != 3 + run_infos || std::strcmp(argv[1], "probe") != 0) {
+        std::fprintf(stderr, "usage: probe-stub probe [--run-infos] [editor mfx file]\n");
+        return -1;
+    }
+
+    std::string name = argv[argc - 1];
+    name = name.substr(name.find_last_of("/\\") + 1);
+    name = name.substr(0, name.rfind('.'));
+
+    std::printf("{\"name\":\"%s\",\"author\":\"Benchmark\",\"copyright\":\"\",\"comment\":\"Generated %s extension.\",\"website\":\"\",\"product\":3,\"build\":295,\"unicode\":true%s}",
+                name.c_str(), name.c_str(), run_infos ? ",\"run_infos\":{\"identifier\":1112425288,\"version\":1,\"edit_flags\":0,\"conditions\":4,\"actions\":8,\"expressions\":2}" : "");
+    return 0;
+}
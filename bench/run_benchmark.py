@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+# End to end cem-tool benchmark.
+# Generates a corpus of extension zip files, runs the whole pipeline over it (probe is stubbed)
+# and compares throughput, latency and peak memory with a stored baseline.
+# Runs use a fixed number of jobs, adjusting them while running would show up as latency noise.
+# bench/baseline.json is committed, record it again with --update-baseline when the reference machine changes.
+#
+#   run_benchmark.py --cem-tool <exe> --probe-command <probe-stub> --baseline bench/baseline.json [--update-baseline]
+#   run_benchmark.py --compare old.json new.json
+
+import argparse
+import json
+import os
+import random
+import shutil
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import zipfile
+
+
+# Runtime file for each platform, same layout the sanity check expects.
+platform_files = [
+    "Data/Runtime/{name}.mfx",
+    "Data/Runtime/Flash/{name}.zip",
+    "Data/Runtime/Android/{name}.zip",
+    "Data/Runtime/iPhone/{name}.ext",
+    "Data/Runtime/Html5/{name}.js",
+    "Data/Runtime/Wua/js/runtime/extensions/source/{name}.js",
+    "Data/Runtime/Mac/{name}.dat",
+    "Data/Runtime/XNA/Windows/{name}.zip",
+]
+
+# Metric name, True if higher is better.
+compared_metrics = [
+    ("archives_per_second", True),
+    ("megabytes_per_second", True),
+    ("p50_ms", False),
+    ("p99_ms", False),
+    ("peak_rss_megabytes", False),
+]
+
+
+# Mix of random and repeated bytes so files compress like real binaries.
+def file_data(rng, size):
+    chunks = []
+    while size > 0:
+        n = min(size, rng.randint(64, 4096))
+        chunks.append(rng.randbytes(n) if rng.random() < 0.4 else bytes([rng.randrange(256)]) * n)
+        size -= n
+    return b"".join(chunks)
+
+
+# Smallest PE32 dll importing kernel32.dll and mmfs2.dll, imports of editor mfx files are checked before probing.
+# Random data after the import section, like the rest of a real dll.
+def pe_file(rng, size):
+    names = b"kernel32.dll\0mmfs2.dll\0"
+    imports = struct.pack("<5I", 0, 0, 0, 0x1000 + 60, 0) + struct.pack("<5I", 0, 0, 0, 0x1000 + 73, 0) + bytes(20) + names
+    section = imports + bytes(0x200 - len(imports))
+
+    dos_header = b"MZ" + bytes(0x3a) + struct.pack("<I", 0x40)
+    file_header = struct.pack("<HHIIIHH", 0x14c, 1, 0, 0, 0, 224, 0x2102)
+    optional_header = bytearray(224)
+    struct.pack_into("<H", optional_header, 0, 0x10b)
+    struct.pack_into("<I", optional_header, 60, 0x200)                  # size of headers
+    struct.pack_into("<III", optional_header, 92, 16, 0, 0)             # data directory count, export directory
+    struct.pack_into("<II", optional_header, 104, 0x1000, 60)           # import directory
+    section_header = struct.pack("<8sIIIIIIHHI", b".idata", len(section), 0x1000, len(section), 0x200, 0, 0, 0, 0, 0xc0000040)
+
+    headers = dos_header + b"PE\0\0" + file_header + bytes(optional_header) + section_header
+    headers += bytes(0x200 - len(headers))
+    return headers + section + file_data(rng, max(size - 0x400, 0))
+
+
+def generate_corpus(directory, count, seed):
+    rng = random.Random(seed)
+    total_size = 0
+
+    for i in range(count):
+        name = "Bench%04d" % i
+        entries = ["Extensions/{name}.mfx"]
+
+        for variant in ("Unicode", "HWA"):
+            if rng.random() < 0.5:
+                entries.append("Extensions/%s/{name}.mfx" % variant)
+                entries.append("Data/Runtime/%s/{name}.mfx" % variant)
+
+        platforms = rng.sample(range(len(platform_files)), rng.randint(1, len(platform_files)))
+        entries += [platform_files[p] for p in sorted(platforms)]
+
+        if rng.random() < 0.6:
+            entries += ["Help/{name}/page%d.html" % n for n in range(rng.randint(1, 20))]
+
+        if rng.random() < 0.4:
+            entries += ["Examples/{name}/example%d.mfa" % n for n in range(rng.randint(1, 5))]
+
+        # Most extensions are small, a few ship large examples.
+        large = rng.random() < 0.05
+        date_time = (2015 + rng.randrange(10), rng.randint(1, 12), rng.randint(1, 28), rng.randrange(24), rng.randrange(60), rng.randrange(30) * 2)
+
+        zip_path = os.path.join(directory, name + ".zip")
+        with zipfile.ZipFile(zip_path, "w", zipfile.ZIP_DEFLATED) as z:
+            for e in entries:
+                size = rng.randint(2 << 20, 8 << 20) if large and e.startswith("Examples/") else rng.randint(1 << 10, 400 << 10)
+                data = pe_file(rng, size) if e.startswith("Extensions/") else file_data(rng, size)
+                z.writestr(zipfile.ZipInfo(e.format(name=name), date_time), data, zipfile.ZIP_DEFLATED)
+
+        total_size += os.path.getsize(zip_path)
+
+    return total_size
+
+
+def run_once(args, corpus_directory, corpus_size):
+    with tempfile.TemporaryDirectory(prefix="cem-tool-bench-") as run_directory:
+        metrics_path = os.path.join(run_directory, "metrics.prom")
+        jobs = "%d:%d" % (args.jobs, args.jobs)
+        command = [args.cem_tool, "--yes", "--jobs", jobs, "--probe-command", args.probe_command, "--metrics", metrics_path, corpus_directory]
+
+        start = time.perf_counter()
+        result = subprocess.run(command, cwd=run_directory, stdout=subprocess.DEVNULL)
+        seconds = time.perf_counter() - start
+
+        if result.returncode != 0:
+            sys.exit("cem-tool failed with exit code %d." % result.returncode)
+
+        with open(metrics_path + ".summary.json") as f:
+            summary = json.load(f)
+
+    archive = summary["stages"]["archive"]
+    processed = summary["counters"]["archives_processed"]
+
+    if processed != args.count:
+        sys.exit("cem-tool processed %d of %d zip files." % (processed, args.count))
+
+    return {
+        "seconds": seconds,
+        "archives_per_second": processed / seconds,
+        "megabytes_per_second": corpus_size / seconds / 1e6,
+        "p50_ms": archive["p50_ms"],
+        "p99_ms": archive["p99_ms"],
+        "peak_rss_megabytes": summary["peak_rss_bytes"] / 1e6,
+    }
+
+
+# Returns number of regressions, changes beyond tolerance in the good direction are only reported.
+def compare(baseline, current, tolerance):
+    if baseline["corpus"] != current["corpus"]:
+        sys.exit("Baseline was recorded with a different corpus %s, current is %s." % (baseline["corpus"], current["corpus"]))
+
+    if baseline.get("jobs") != current.get("jobs"):
+        sys.exit("Baseline was recorded with %s jobs, current run used %s." % (baseline.get("jobs"), current.get("jobs")))
+
+    regressions = 0
+    print("%-22s %12s %12s %9s" % ("metric", "baseline", "current", "change"))
+
+    for name, higher_is_better in compared_metrics:
+        old = baseline["results"][name]
+        new = current["results"][name]
+        change = (new - old) / old if old else 0.0
+
+        status = ""
+        if abs(change) > tolerance:
+            better = (change > 0) == higher_is_better
+            status = "improved" if better else "REGRESSION"
+            regressions += not better
+
+        print("%-22s %12.3f %12.3f %+8.1f%% %s" % (name, old, new, change * 100, status))
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="End to end cem-tool benchmark.")
+    parser.add_argument("--cem-tool", help="cem-tool executable")
+    parser.add_argument("--probe-command", help="probe stub executable")
+    parser.add_argument("--baseline", help="baseline file, has to exist unless --update-baseline is given")
+    parser.add_argument("--output", help="also write results of this run to this file")
+    parser.add_argument("--update-baseline", action="store_true", help="replace baseline with this run")
+    parser.add_argument("--tolerance", type=float, default=float(os.environ.get("CEM_TOOL_BENCH_TOLERANCE", "0.15")), help="allowed relative change (default: 0.15)")
+    parser.add_argument("--count", type=int, default=200, help="number of zip files in corpus (default: 200)")
+    parser.add_argument("--seed", type=int, default=1, help="corpus seed (default: 1)")
+    parser.add_argument("--runs", type=int, default=3, help="runs, median is reported (default: 3)")
+    parser.add_argument("--jobs", type=int, default=4, help="fixed number of cem-tool jobs (default: 4)")
+    parser.add_argument("--compare", nargs=2, metavar=("BASELINE", "RESULTS"), help="only compare two result files")
+    args = parser.parse_args()
+
+    if args.compare:
+        with open(args.compare[0]) as a, open(args.compare[1]) as b:
+            return 1 if compare(json.load(a), json.load(b), args.tolerance) else 0
+
+    if not args.cem_tool or not args.probe_command or not args.baseline:
+        parser.error("--cem-tool, --probe-command and --baseline are required")
+
+    # Checked before the slow part, a run without anything to compare with would always pass.
+    if not args.update_baseline and not os.path.exists(args.baseline):
+        sys.exit("No baseline '%s', record one with --update-baseline." % args.baseline)
+
+    # cem-tool runs in its own directory.
+    args.cem_tool = os.path.abspath(args.cem_tool)
+    args.probe_command = os.path.abspath(args.probe_command)
+
+    corpus_directory = tempfile.mkdtemp(prefix="cem-tool-corpus-")
+    try:
+        corpus_size = generate_corpus(corpus_directory, args.count, args.seed)
+        print("Generated %d zip files, %.1f MB." % (args.count, corpus_size / 1e6))
+
+        runs = [run_once(args, corpus_directory, corpus_size) for _ in range(args.runs)]
+    finally:
+        shutil.rmtree(corpus_directory, ignore_errors=True)
+
+    current = {
+        "corpus": {"count": args.count, "seed": args.seed, "bytes": corpus_size},
+        "jobs": args.jobs,
+        "results": {name: statistics.median(r[name] for r in runs) for name in runs[0]},
+    }
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(current, f, indent="\t")
+
+    if args.update_baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(current, f, indent="\t")
+        print("Wrote baseline '%s'." % args.baseline)
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    regressions = compare(baseline, current, args.tolerance)
+    if regressions:
+        print("%d metrics regressed more than %.0f%%." % (regressions, args.tolerance * 100))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Long run memory check.
+# Processes a short and a long batch of zip files in one cem-tool process each and fails if peak memory
+# grows with the number of zip files, anything leaked per zip file shows up in the long run.
+#
+#   soak.py --cem-tool <exe> --probe-command <probe-stub> [--count 2000]
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from run_benchmark import generate_corpus
+
+
+# Zip files are linked under new names, only a few distinct ones have to be generated.
+# Names dont match the extension inside anymore, runs use --ignore-errors.
+def make_batch(directory, corpus_directory, count):
+    os.makedirs(directory)
+    corpus = sorted(os.listdir(corpus_directory))
+
+    for i in range(count):
+        source = os.path.join(corpus_directory, corpus[i % len(corpus)])
+        target = os.path.join(directory, "Soak%05d.zip" % i)
+        try:
+            os.link(source, target)
+        except OSError:
+            shutil.copyfile(source, target)
+
+
+def run_batch(args, batch_directory, count):
+    with tempfile.TemporaryDirectory(prefix="cem-tool-soak-") as run_directory:
+        metrics_path = os.path.join(run_directory, "metrics.prom")
+        command = [args.cem_tool, "--yes", "--ignore-errors", "--probe-command", args.probe_command, "--metrics", metrics_path, batch_directory]
+        result = subprocess.run(command, cwd=run_directory, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+
+        if result.returncode != 0:
+            sys.exit("%scem-tool failed with exit code %d." % (result.stderr, result.returncode))
+
+        with open(metrics_path + ".summary.json") as f:
+            summary = json.load(f)
+
+    processed = summary["counters"]["archives_processed"]
+    if processed != count:
+        sys.exit("cem-tool processed %d of %d zip files." % (processed, count))
+
+    return summary["peak_rss_bytes"]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Long run memory check.")
+    parser.add_argument("--cem-tool", required=True, help="cem-tool executable")
+    parser.add_argument("--probe-command", required=True, help="probe stub executable")
+    parser.add_argument("--count", type=int, default=2000, help="zip files in the long run (default: 2000)")
+    parser.add_argument("--distinct", type=int, default=20, help="distinct zip files generated (default: 20)")
+    parser.add_argument("--tolerance", type=float, default=0.1, help="allowed peak memory growth of the long run (default: 0.1)")
+    args = parser.parse_args()
+
+    args.cem_tool = os.path.abspath(args.cem_tool)
+    args.probe_command = os.path.abspath(args.probe_command)
+
+    # Short run still sees every distinct zip file, so only growth over time is compared.
+    short_count = max(args.count // 10, args.distinct)
+
+    work_directory = tempfile.mkdtemp(prefix="cem-tool-soak-")
+    try:
+        corpus_directory = os.path.join(work_directory, "corpus")
+        os.makedirs(corpus_directory)
+        generate_corpus(corpus_directory, args.distinct, 1)
+
+        make_batch(os.path.join(work_directory, "short"), corpus_directory, short_count)
+        make_batch(os.path.join(work_directory, "long"), corpus_directory, args.count)
+
+        short_peak = run_batch(args, os.path.join(work_directory, "short"), short_count)
+        long_peak = run_batch(args, os.path.join(work_directory, "long"), args.count)
+    finally:
+        shutil.rmtree(work_directory, ignore_errors=True)
+
+    growth = (long_peak - short_peak) / short_peak
+    print("Peak memory: %.1f MB after %d zip files, %.1f MB after %d (%+.1f%%)." % (short_peak / 1e6, short_count, long_peak / 1e6, args.count, growth * 100))
+
+    if growth > args.tolerance:
+        print("Peak memory grew more than %.0f%%, something leaks per zip file." % (args.tolerance * 100))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+#include "binary_catalog.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+
+namespace format = binary_catalog_format;
+
+
+static std::uint64_t align8(std::uint64_t offset) {
+    return (offset + 7) & ~std::uint64_t(7);
+}
+
+template<class T>
+static void append_section(std::vector<std::uint8_t>& buffer, std::uint64_t* offset, const std::vector<T>& section) {
+    buffer.resize(align8(buffer.size()));
+    *offset = buffer.size();
+
+    auto bytes = reinterpret_cast<const std::uint8_t*>(section.data());
+    buffer.insert(buffer.end(), bytes, bytes + section.size() * sizeof(T));
+}
+
+
+std::vector<std::uint8_t> binary_catalog::serialize(const std::vector<fusion::cem_ext_manifest>& manifests) {
+    std::vector<std::uint8_t> strings;
+    std::unordered_map<std::string_view, std::uint32_t> string_offsets;    // Views into manifests
+
+    auto add_string = [&](std::string_view str) -> std::uint32_t {
+        auto it = string_offsets.find(str);
+        if(it != string_offsets.end()) {
+            return it->second;
+        }
+
+        auto offset = static_cast<std::uint32_t>(strings.size());
+        auto length = static_cast<std::uint32_t>(str.size());
+
+        strings.resize(strings.size() + sizeof(length));
+        std::memcpy(strings.data() + offset, &length, sizeof(length));
+        strings.insert(strings.end(), str.begin(), str.end());
+        strings.push_back('\0');
+
+        string_offsets.emplace(str, offset);
+        return offset;
+    };
+
+    std::vector<format::record> records;
+    std::vector<std::uint32_t> files;
+
+    for (auto &&m : manifests) {
+        format::record r = {};
+        r.mfxname = add_string(m.mfxname);
+        r.name = add_string(m.name);
+        r.author = add_string(m.author);
+        r.description = add_string(m.description);
+        r.website = add_string(m.website);
+        r.download = add_string(m.download);
+        r.first_file = static_cast<std::uint32_t>(files.size());
+        r.file_count = static_cast<std::uint32_t>(m.files.size());
+        r.platforms = m.platforms;
+        r.dev = m.dev;
+        r.time = m.time;
+        r.zipsize = m.zipsize;
+
+        for (auto &&f : m.files) {
+            files.push_back(add_string(f));
+        }
+
+        records.push_back(r);
+    }
+
+    std::vector<std::uint32_t> name_index(manifests.size());
+    std::iota(name_index.begin(), name_index.end(), 0);
+    std::stable_sort(name_index.begin(), name_index.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return manifests[a].mfxname < manifests[b].mfxname;
+    });
+
+    std::vector<format::platform_range> platform_index;
+    std::vector<std::uint32_t> platform_records;
+
+    for (std::uint32_t p = 0; p < format::platform_count; p++) {
+        format::platform_range range = {static_cast<std::uint32_t>(platform_records.size()), 0};
+
+        for (auto &&i : name_index) {
+            if(manifests[i].platforms & fusion::platform_index_to_enum(p)) {
+                platform_records.push_back(i);
+                range.count++;
+            }
+        }
+
+        platform_index.push_back(range);
+    }
+
+    format::header h = {};
+    std::memcpy(h.magic, format::magic, sizeof(h.magic));
+    h.version = format::version;
+    h.record_count = static_cast<std::uint32_t>(records.size());
+    h.file_count = static_cast<std::uint32_t>(files.size());
+    h.platform_record_count = static_cast<std::uint32_t>(platform_records.size());
+
+    std::vector<std::uint8_t> buffer(sizeof(h));
+    append_section(buffer, &h.records_offset, records);
+    append_section(buffer, &h.files_offset, files);
+    append_section(buffer, &h.name_index_offset, name_index);
+    append_section(buffer, &h.platform_index_offset, platform_index);
+    append_section(buffer, &h.platform_records_offset, platform_records);
+    append_section(buffer, &h.strings_offset, strings);
+    h.strings_size = strings.size();
+
+    std::memcpy(buffer.data(), &h, sizeof(h));
+    return buffer;
+}
+
+
+
+binary_catalog::~binary_catalog() {
+    close();
+}
+
+
+void binary_catalog::open(const std::filesystem::path& file_path) {
+    if(is_open()) {
+        close();
+    }
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(file_path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        throw create_except<std::runtime_error>("Failed to open binary catalog '%s': %s.", file_path.string().c_str(), last_system_error().c_str());
+    }
+    file_handle = file;
+
+    LARGE_INTEGER file_size;
+    mapping_handle = GetFileSizeEx(file, &file_size) ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    data = mapping_handle ? static_cast<const std::uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+    if(!data) {
+        auto error = last_system_error();
+        close();
+        throw create_except<std::runtime_error>("Failed to map binary catalog '%s': %s.", file_path.string().c_str(), error.c_str());
+    }
+    data_size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw create_except<std::runtime_error>("Failed to open binary catalog '%s': %s.", file_path.string().c_str(), last_system_error().c_str());
+    }
+
+    struct stat file_stat;
+    void* mapped = MAP_FAILED;
+    if(fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+        mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    auto error = last_system_error();
+    ::close(fd);    // Mapping stays valid
+
+    if(mapped == MAP_FAILED) {
+        throw create_except<std::runtime_error>("Failed to map binary catalog '%s': %s.", file_path.string().c_str(), error.c_str());
+    }
+    data = static_cast<const std::uint8_t*>(mapped);
+    data_size = static_cast<std::size_t>(file_stat.st_size);
+#endif
+
+    // Only check that sections are inside the file, indices are checked when used.
+    header = reinterpret_cast<const format::header*>(data);
+
+    auto section_fits = [&](std::uint64_t offset, std::uint64_t count, std::uint64_t element_size) {
+        return offset % 8 == 0 && offset <= data_size && count <= (data_size - offset) / element_size;
+    };
+
+    bool valid = data_size >= sizeof(format::header)
+              && std::memcmp(header->magic, format::magic, sizeof(format::magic)) == 0
+              && header->version == format::version
+              && section_fits(header->records_offset, header->record_count, sizeof(format::record))
+              && section_fits(header->files_offset, header->file_count, sizeof(std::uint32_t))
+              && section_fits(header->name_index_offset, header->record_count, sizeof(std::uint32_t))
+              && section_fits(header->platform_index_offset, format::platform_count, sizeof(format::platform_range))
+              && section_fits(header->platform_records_offset, header->platform_record_count, sizeof(std::uint32_t))
+              && section_fits(header->strings_offset, header->strings_size, 1);
+
+    if(!valid) {
+        close();
+        throw create_except<std::runtime_error>("Bad binary catalog '%s'.", file_path.string().c_str());
+    }
+
+    records = reinterpret_cast<const format::record*>(data + header->records_offset);
+    files = reinterpret_cast<const std::uint32_t*>(data + header->files_offset);
+    name_index = reinterpret_cast<const std::uint32_t*>(data + header->name_index_offset);
+    platform_index = reinterpret_cast<const format::platform_range*>(data + header->platform_index_offset);
+    platform_records = reinterpret_cast<const std::uint32_t*>(data + header->platform_records_offset);
+}
+
+void binary_catalog::close() {
+#ifdef _WIN32
+    if(data) {
+        UnmapViewOfFile(data);
+    }
+    if(mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if(file_handle) {
+        CloseHandle(file_handle);
+    }
+#else
+    if(data) {
+        munmap(const_cast<std::uint8_t*>(data), data_size);
+    }
+#endif
+
+    data = nullptr;
+    data_size = 0;
+    header = nullptr;
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+}
+
+
+bool binary_catalog::is_open() {
+    return data != nullptr;
+}
+
+
+std::size_t binary_catalog::size() const {
+    return header ? header->record_count : 0;
+}
+
+
+std::string_view binary_catalog::string(std::uint32_t offset) const {
+    std::uint32_t length = 0;
+
+    if(offset + std::uint64_t(sizeof(length)) > header->strings_size) {
+        throw std::out_of_range("Bad binary catalog string offset.");
+    }
+
+    auto strings = data + header->strings_offset;
+    std::memcpy(&length, strings + offset, sizeof(length));
+
+    if(offset + std::uint64_t(sizeof(length)) + length > header->strings_size) {
+        throw std::out_of_range("Bad binary catalog string length.");
+    }
+
+    return std::string_view(reinterpret_cast<const char*>(strings + offset + sizeof(length)), length);
+}
+
+const binary_catalog_format::record& binary_catalog::record(std::size_t index) const {
+    // Name index and platform records come from the file too.
+    if(index >= size()) {
+        throw std::out_of_range("Bad binary catalog record index.");
+    }
+
+    return records[index];
+}
+
+std::string_view binary_catalog::mfxname(std::size_t index) const {
+    return string(record(index).mfxname);
+}
+
+std::string_view binary_catalog::name(std::size_t index) const {
+    return string(record(index).name);
+}
+
+std::string_view binary_catalog::author(std::size_t index) const {
+    return string(record(index).author);
+}
+
+std::string_view binary_catalog::description(std::size_t index) const {
+    return string(record(index).description);
+}
+
+std::string_view binary_catalog::website(std::size_t index) const {
+    return string(record(index).website);
+}
+
+std::string_view binary_catalog::download(std::size_t index) const {
+    return string(record(index).download);
+}
+
+std::size_t binary_catalog::file_count(std::size_t index) const {
+    return record(index).file_count;
+}
+
+std::string_view binary_catalog::file(std::size_t index, std::size_t file_index) const {
+    auto &&r = record(index);
+
+    if(file_index >= r.file_count || r.first_file + std::uint64_t(file_index) >= header->file_count) {
+        throw std::out_of_range("Bad binary catalog file index.");
+    }
+
+    return string(files[r.first_file + file_index]);
+}
+
+
+std::optional<std::size_t> binary_catalog::find(std::string_view mfxname) const {
+    auto begin = name_index;
+    auto end = name_index + size();
+
+    auto it = std::lower_bound(begin, end, mfxname, [&](std::uint32_t i, std::string_view name) {
+        return this->mfxname(i) < name;
+    });
+
+    if(it == end || this->mfxname(*it) != mfxname) {
+        return std::nullopt;
+    }
+
+    return *it;
+}
+
+std::span<const std::uint32_t> binary_catalog::with_platform(fusion::platform platform) const {
+    // platform_enum_to_index() maps anything else to windows.
+    if(!std::has_single_bit(static_cast<std::uint32_t>(platform)) || platform >= fusion::platform::last) {
+        throw create_except<std::runtime_error>("Bad platform 0x%x, expected exactly one platform.", static_cast<unsigned>(platform));
+    }
+
+    if(!header) {
+        return {};
+    }
+
+    auto range = platform_index[fusion::platform_enum_to_index(platform)];
+    if(range.first + std::uint64_t(range.count) > header->platform_record_count) {
+        throw std::out_of_range("Bad binary catalog platform range.");
+    }
+
+    return std::span<const std::uint32_t>(platform_records + range.first, range.count);
+}
+
+
+fusion::cem_ext_manifest binary_catalog::to_manifest(std::size_t index) const {
+    auto &&r = record(index);
+    fusion::cem_ext_manifest ext = {};
+
+    ext.mfxname = mfxname(index);
+    ext.name = name(index);
+    ext.author = author(index);
+    ext.description = description(index);
+    ext.website = website(index);
+    ext.dev = r.dev;
+    ext.platforms = r.platforms;
+    ext.download = download(index);
+    ext.time = static_cast<time_t>(r.time);
+    ext.zipsize = r.zipsize;
+
+    for (std::size_t i = 0; i < r.file_count; i++) {
+        ext.files.push_back(file(index, i));
+    }
+
+    return ext;
+}
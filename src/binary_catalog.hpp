@@ -0,0 +1,126 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+#include "fusion_ext.hpp"
+
+// Compact catalog that can be memory mapped and used without parsing.
+//
+// Layout (little endian, every section 8 byte aligned):
+//   header
+//   records              one fixed size record per extension, same order as the json catalog
+//   files                string offsets, records point to a range of them
+//   name index           record indices sorted by mfxname
+//   platform index       for each fusion::platform bit: first and count in platform records
+//   platform records     record indices sorted by mfxname, grouped by platform
+//   strings              deduplicated, each is u32 length + bytes + '\0'
+//
+// footprint and run_infos (--footprint, --run-infos) are not stored, use the json catalog for those.
+
+
+
+namespace binary_catalog_format {
+    static constexpr char magic[8] = {'C', 'E', 'M', 'C', 'A', 'T', '\0', '\0'};
+    static constexpr std::uint32_t version = 1;
+    static constexpr std::uint32_t platform_count = 8;       // fusion::platform bits
+
+    struct header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t record_count;
+        std::uint32_t file_count;
+        std::uint32_t platform_record_count;
+        std::uint64_t records_offset;
+        std::uint64_t files_offset;
+        std::uint64_t name_index_offset;
+        std::uint64_t platform_index_offset;
+        std::uint64_t platform_records_offset;
+        std::uint64_t strings_offset;
+        std::uint64_t strings_size;
+    };
+
+    struct record {
+        std::uint32_t mfxname;              // Offsets in strings
+        std::uint32_t name;
+        std::uint32_t author;
+        std::uint32_t description;
+        std::uint32_t website;
+        std::uint32_t download;
+        std::uint32_t first_file;           // Index in files
+        std::uint32_t file_count;
+        std::uint32_t platforms;            // fusion::platform bits
+        std::uint32_t dev;
+        std::int64_t time;
+        std::uint64_t zipsize;
+    };
+
+    struct platform_range {
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    static_assert(sizeof(header) == 80);
+    static_assert(sizeof(record) == 56);
+}
+
+
+class binary_catalog {
+public:
+    binary_catalog() = default;
+    binary_catalog(const binary_catalog&) = delete;
+    binary_catalog& operator=(const binary_catalog&) = delete;
+    ~binary_catalog();
+
+    // Manifests should already be sorted by mfxname (see catalog::finalize()).
+    static std::vector<std::uint8_t> serialize(const std::vector<fusion::cem_ext_manifest>& manifests);
+
+    void open(const std::filesystem::path& file_path);
+    void close();
+
+    bool is_open();
+
+    std::size_t size() const;
+
+    // Views into the mapped file, valid until close().
+    // Indices pointing outside their section (corrupt file) throw std::out_of_range.
+    std::string_view mfxname(std::size_t index) const;
+    std::string_view name(std::size_t index) const;
+    std::string_view author(std::size_t index) const;
+    std::string_view description(std::size_t index) const;
+    std::string_view website(std::size_t index) const;
+    std::string_view download(std::size_t index) const;
+    std::size_t file_count(std::size_t index) const;
+    std::string_view file(std::size_t index, std::size_t file_index) const;
+    const binary_catalog_format::record& record(std::size_t index) const;
+
+    // Binary search in the name index.
+    std::optional<std::size_t> find(std::string_view mfxname) const;
+
+    // Indices of extensions supporting the platform (one platform bit), sorted by mfxname.
+    std::span<const std::uint32_t> with_platform(fusion::platform platform) const;
+
+    // Copy record back to a manifest, without footprint and run_infos.
+    fusion::cem_ext_manifest to_manifest(std::size_t index) const;
+
+private:
+    const std::uint8_t* data = nullptr;
+    std::size_t data_size = 0;
+
+    const binary_catalog_format::header* header = nullptr;
+    const binary_catalog_format::record* records = nullptr;
+    const std::uint32_t* files = nullptr;
+    const std::uint32_t* name_index = nullptr;
+    const binary_catalog_format::platform_range* platform_index = nullptr;
+    const std::uint32_t* platform_records = nullptr;
+
+    // Mapping handles
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+
+    std::string_view string(std::uint32_t offset) const;
+};
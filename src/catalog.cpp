@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+
+#include "catalog.hpp"
+#include "string_helper.hpp"
+
+#include "nlohmann/json.hpp"
+
+
+
+void catalog::add(fusion::cem_ext_manifest ext_man, const std::string& source) {
+    manifests.push_back(std::move(ext_man));
+    sources.push_back(source);
+}
+
+void catalog::load(const std::filesystem::path& file_path) {
+    std::ifstream input(file_path);
+
+    if(!input) {
+        throw create_except<std::runtime_error>("Failed to open catalog '%s'.", file_path.string().c_str());
+    }
+
+    nlohmann::ordered_json j;
+
+    try {
+        j = nlohmann::ordered_json::parse(input);
+    }
+    catch(const nlohmann::json::exception& e) {
+        throw create_except<std::runtime_error>("Failed to parse catalog '%s': %s", file_path.string().c_str(), e.what());
+    }
+
+    if(!j.is_array()) {
+        throw create_except<std::runtime_error>("Bad catalog '%s': Expected an array of extension manifests.", file_path.string().c_str());
+    }
+
+    for (auto &&e : j) {
+        add(fusion::cem_ext_manifest::from_json_object(e), file_path.string());
+    }
+}
+
+
+void catalog::finalize() {
+    // Sort indices so manifests and sources stay together, stable so the first source wins in messages.
+    std::vector<size_t> order(manifests.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return manifests[a].mfxname < manifests[b].mfxname;
+    });
+
+    std::vector<fusion::cem_ext_manifest> sorted_manifests;
+    std::vector<std::string> sorted_sources;
+    std::string conflicts;
+
+    for (auto &&i : order) {
+        if(!sorted_manifests.empty() && sorted_manifests.back().mfxname == manifests[i].mfxname) {
+            if(sorted_manifests.back().to_json() != manifests[i].to_json()) {
+                conflicts += "\n  '" + manifests[i].mfxname + "' in '" + sorted_sources.back() + "' and '" + sources[i] + "'";
+            }
+            continue;
+        }
+
+        sorted_manifests.push_back(std::move(manifests[i]));
+        sorted_sources.push_back(std::move(sources[i]));
+    }
+
+    manifests = std::move(sorted_manifests);
+    sources = std::move(sorted_sources);
+
+    if(!conflicts.empty()) {
+        throw create_except<std::runtime_error>("Catalog has conflicting extensions with the same mfxname:%s", conflicts.c_str());
+    }
+}
+
+
+const std::vector<fusion::cem_ext_manifest>& catalog::entries() const {
+    return manifests;
+}
+
+std::string catalog::to_json() const {
+    nlohmann::ordered_json j = nlohmann::ordered_json::array();
+
+    for (auto &&m : manifests) {
+        j.push_back(m.to_json_object());
+    }
+
+    return j.dump(1, '\t');     // tabs indent, same as single manifests
+}
+
+std::string catalog::delta_json(const catalog& previous, std::size_t* added, std::size_t* removed, std::size_t* changed) const {
+    nlohmann::ordered_json j_added = nlohmann::ordered_json::array();
+    nlohmann::ordered_json j_removed = nlohmann::ordered_json::array();
+    nlohmann::ordered_json j_changed = nlohmann::ordered_json::array();
+
+    auto &&old_manifests = previous.manifests;
+    size_t o = 0, n = 0;
+
+    // Both are sorted by mfxname, walk them together.
+    while(o < old_manifests.size() || n < manifests.size()) {
+        if(n == manifests.size() || (o < old_manifests.size() && old_manifests[o].mfxname < manifests[n].mfxname)) {
+            j_removed.push_back(old_manifests[o++].mfxname);
+            continue;
+        }
+
+        if(o == old_manifests.size() || manifests[n].mfxname < old_manifests[o].mfxname) {
+            j_added.push_back(manifests[n++].to_json_object());
+            continue;
+        }
+
+        auto old_j = old_manifests[o++].to_json_object();
+        auto new_j = manifests[n++].to_json_object();
+        nlohmann::ordered_json changes = nlohmann::ordered_json::object();
+
+        for (auto &&[key, value] : new_j.items()) {
+            auto old_value = old_j.value(key, nlohmann::ordered_json());
+            if(value == old_value) {
+                continue;
+            }
+
+            if(key != "files") {
+                changes[key] = {{"old", old_value}, {"new", value}};
+                continue;
+            }
+
+            // Files only list what was added and removed.
+            std::vector<std::string> old_files, new_files, files_added, files_removed;
+            for (auto &&f : old_value) old_files.push_back(f.get<std::string>());
+            for (auto &&f : value) new_files.push_back(f.get<std::string>());
+            std::sort(old_files.begin(), old_files.end());
+            std::sort(new_files.begin(), new_files.end());
+            std::set_difference(new_files.begin(), new_files.end(), old_files.begin(), old_files.end(), std::back_inserter(files_added));
+            std::set_difference(old_files.begin(), old_files.end(), new_files.begin(), new_files.end(), std::back_inserter(files_removed));
+
+            if(!files_added.empty() || !files_removed.empty()) {
+                changes[key] = {{"added", files_added}, {"removed", files_removed}};
+            }
+        }
+
+        // Optional fields like footprint or run_infos left out this time.
+        for (auto &&[key, value] : old_j.items()) {
+            if(!new_j.contains(key)) {
+                changes[key] = {{"old", value}, {"new", nullptr}};
+            }
+        }
+
+        if(!changes.empty()) {
+            j_changed.push_back({{"mfxname", new_j["mfxname"]}, {"changes", changes}});
+        }
+    }
+
+    *added = j_added.size();
+    *removed = j_removed.size();
+    *changed = j_changed.size();
+
+    nlohmann::ordered_json j = {
+        {"added", j_added},
+        {"removed", j_removed},
+        {"changed", j_changed},
+    };
+
+    return j.dump(1, '\t');
+}
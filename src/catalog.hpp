@@ -0,0 +1,37 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <string>
+
+#include "fusion_ext.hpp"
+
+// Catalog is a json array of extension manifests sorted by mfxname.
+// Catalogs created on different machines (see --shard) can be loaded together and saved as one.
+
+
+
+class catalog {
+public:
+    catalog() = default;
+    ~catalog() = default;
+
+    void add(fusion::cem_ext_manifest ext_man, const std::string& source);
+    void load(const std::filesystem::path& file_path);
+
+    // Sort by mfxname and drop duplicates that are exactly the same.
+    // Throws if there are different manifests with the same mfxname.
+    void finalize();
+
+    const std::vector<fusion::cem_ext_manifest>& entries() const;
+    std::string to_json() const;
+
+    // Changelog from previous catalog to this one, both have to be finalized:
+    // {"added": [manifests], "removed": [mfxnames], "changed": [{"mfxname", "changes": {field: {"old", "new"}, "files": {"added", "removed"}}}]}
+    // Fields only in the previous manifest have "new": null.
+    std::string delta_json(const catalog& previous, std::size_t* added, std::size_t* removed, std::size_t* changed) const;
+
+private:
+    std::vector<fusion::cem_ext_manifest> manifests;
+    std::vector<std::string> sources;       // Where each manifest came from, used in conflict errors.
+};
@@ -3,17 +3,53 @@
 #include <cstdio>
 #include <ctime>
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <optional>
+#include <thread>
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <iterator>
 
 #include "cem_tool.hpp"
+#include "binary_catalog.hpp"
+#include "concurrency_controller.hpp"
+#include "directory_scanner.hpp"
+#include "directory_watcher.hpp"
+#include "ext_checker.hpp"
+#include "http_file.hpp"
+#include "metrics.hpp"
+#include "minhash.hpp"
+#include "output_writer.hpp"
+#include "pe_imports.hpp"
+#include "manifest_index.hpp"
+#include "zip_repack.hpp"
+#include "process.hpp"
 #include "zip_archive.hpp"
 #include "string_helper.hpp"
 
+#include "nlohmann/json.hpp"
+
 
 
 cem_tool::cem_tool(const std::vector<std::string>& args) {
     for (size_t i = 1; i < args.size(); i++) {
         auto &&arg = args[i];
 
+        // Returns value of flags like '--catalog <file>'
+        auto flag_value = [&]() -> const std::string& {
+            if(i + 1 >= args.size()) {
+                std::fprintf(stderr, "flag '%s' requires a value.\n%s", arg.c_str(), usage);
+                exit(-1);
+            }
+            return args[++i];
+        };
+
         // Check if arg is a flag
         if(arg.compare(0, 2, "--") == 0) {
             // Look for recognized flags.
@@ -37,283 +73,1465 @@ cem_tool::cem_tool(const std::vector<std::string>& args) {
                 continue;
             }
 
-            std::fprintf(stderr, "not recognized a flag: '%s'.\n%s", arg.c_str(), usage);
-            exit(-1);
-        } else {
-            // If not a flag assume its a path to zip file.
-            // Make sure provided file path is valid.
-            ext_zip_filepath = std::filesystem::absolute(arg);
+            if(arg == "--catalog") {
+                catalog_filepath = std::filesystem::absolute(flag_value());
+                continue;
+            }
 
-            if(!std::filesystem::exists(ext_zip_filepath)) {
-                std::fprintf(stderr, "File doesnt exist.\n%s", usage);
-                exit(-1);
+            if(arg == "--binary-catalog") {
+                binary_catalog_filepath = std::filesystem::absolute(flag_value());
+                continue;
             }
 
-            if(!std::filesystem::is_regular_file(ext_zip_filepath)) {
-                std::fprintf(stderr, "Not a file.\n%s", usage);
-                exit(-1);
+            if(arg == "--delta") {
+                delta_base_filepath = std::filesystem::absolute(flag_value());
+                continue;
             }
 
-            if(ext_zip_filepath.extension() != ".zip") {
-                std::fprintf(stderr, "Not a zip file.\n%s", usage);
-                exit(-1);
+            if(arg == "--footprint") {
+                footprint = true;
+                continue;
+            }
+
+            if(arg == "--run-infos") {
+                run_infos = true;
+                continue;
+            }
+
+            if(arg == "--gzip") {
+                precompress_formats.push_back(precompress_format::gzip);
+                continue;
+            }
+
+            if(arg == "--zstd") {
+                if(!precompress_supported(precompress_format::zstd)) {
+                    std::fprintf(stderr, "This build cant write zstd files, it was built without libzstd.\n%s", usage);
+                    exit(-1);
+                }
+
+                precompress_formats.push_back(precompress_format::zstd);
+                continue;
+            }
+
+            if(arg == "--index") {
+                index_filepath = std::filesystem::absolute(flag_value());
+                continue;
+            }
+
+            if(arg == "--jobs") {
+                auto &&value = flag_value();
+
+                // <n> or <min>:<max>
+                int parsed = std::sscanf(value.c_str(), "%u:%u", &min_jobs, &jobs);
+                if(parsed == 1) {
+                    jobs = min_jobs;
+                }
+
+                if(parsed < 1 || jobs == 0 || min_jobs == 0 || min_jobs > jobs) {
+                    std::fprintf(stderr, "Bad number of jobs '%s'.\n%s", value.c_str(), usage);
+                    exit(-1);
+                }
+                continue;
+            }
+
+            if(arg == "--level") {
+                auto &&value = flag_value();
+
+                if(std::sscanf(value.c_str(), "%d", &compress_level) != 1 || compress_level < 0 || compress_level > 9) {
+                    std::fprintf(stderr, "Bad compression level '%s'.\n%s", value.c_str(), usage);
+                    exit(-1);
+                }
+                continue;
+            }
+
+            if(arg == "--threshold") {
+                auto &&value = flag_value();
+
+                if(std::sscanf(value.c_str(), "%lf", &similar_threshold) != 1 || similar_threshold < 0 || similar_threshold > 1) {
+                    std::fprintf(stderr, "Bad threshold '%s', expected a number from 0 to 1.\n%s", value.c_str(), usage);
+                    exit(-1);
+                }
+                continue;
+            }
+
+            if(arg == "--watch") {
+                watch_directory = std::filesystem::absolute(flag_value());
+
+                if(!std::filesystem::is_directory(watch_directory)) {
+                    std::fprintf(stderr, "Not a directory: '%s'.\n%s", watch_directory.string().c_str(), usage);
+                    exit(-1);
+                }
+                continue;
+            }
+
+            if(arg == "--metrics") {
+                metrics_filepath = std::filesystem::absolute(flag_value());
+                continue;
+            }
+
+            if(arg == "--no-probe") {
+                no_probe = true;
+                continue;
+            }
+
+            if(arg == "--probe-command") {
+                probe_command = std::filesystem::absolute(flag_value());
+                continue;
+            }
+
+            if(arg == "--output") {
+                output_filepath = std::filesystem::absolute(flag_value());
+                continue;
             }
 
+            if(arg == "--output-dir") {
+                output_directory = std::filesystem::absolute(flag_value());
+                continue;
+            }
+
+            if(arg == "--shard") {
+                auto &&value = flag_value();
+                unsigned long long index = 0, count = 0;
+
+                if(std::sscanf(value.c_str(), "%llu/%llu", &index, &count) != 2 || index < 1 || index > count) {
+                    std::fprintf(stderr, "Bad shard '%s', expected i/N where 1 <= i <= N.\n%s", value.c_str(), usage);
+                    exit(-1);
+                }
+
+                shard_index = index - 1;
+                shard_count = count;
+                continue;
+            }
+
+            std::fprintf(stderr, "not recognized a flag: '%s'.\n%s", arg.c_str(), usage);
+            exit(-1);
+        } else if(arg == "merge" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::merge;
+            continue;
+        } else if(arg == "probe" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::probe;
+            continue;
+        } else if(arg == "index" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::index;
+            continue;
+        } else if(arg == "query" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::query;
+            continue;
+        } else if(arg == "repack" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::repack;
+            continue;
+        } else if(arg == "imports" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::imports;
+            continue;
+        } else if(arg == "similar" && command == command_type::generate && input_filepaths.empty()) {
+            command = command_type::similar;
+            continue;
+        } else if(command == command_type::query) {
+            query_terms.push_back(arg);
+            continue;
+        } else {
+            add_input(arg);
             continue;
         }
     }
 
-    if(ext_zip_filepath.empty()) {
+    if(!watch_directory.empty() && (command != command_type::generate || !input_filepaths.empty() || !input_urls.empty() || want_catalog())) {
+        std::fprintf(stderr, "--watch only writes manifests for zip files in the watched directory.\n%s", usage);
+        exit(-1);
+    }
+
+    // Index can be refreshed without new files.
+    if(input_filepaths.empty() && input_urls.empty() && watch_directory.empty() && command != command_type::index && command != command_type::query) {
         std::printf("No file provided.\n%s", usage);
         exit(0);
     }
-}
 
+    if(command == command_type::query && query_terms.empty()) {
+        std::printf("Nothing to search for.\n%s", usage);
+        exit(0);
+    }
 
-int cem_tool::run() {
-    fusion::cem_ext_manifest ext_man = {};
-    std::filesystem::path editor_mfx;           // Used to get mfx name and gets loaded later.
+    if(jobs == 0) {
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    if(min_jobs == 0) {
+        min_jobs = jobs;
+    }
 
-    if(std::filesystem::exists("./temp")) {
-        std::printf("Directory './temp' already exists.\n");
-        if(!yes) {
-            std::printf("Delete './temp' directory? [y/n] ");
+    // Several zip files would all be repacked to the same file, a directory gets one file each.
+    bool output_is_directory = !output_filepath.has_filename() || std::filesystem::is_directory(output_filepath);
+    if(command == command_type::repack && !output_filepath.empty() && !output_is_directory && input_filepaths.size() > 1) {
+        std::fprintf(stderr, "--output has to be a directory (existing or ending with '/') with several zip files.\n%s", usage);
+        exit(-1);
+    }
 
-            char buf;
-            std::scanf("%c", &buf);
+    if(!delta_base_filepath.empty() && catalog_filepath.empty() && binary_catalog_filepath.empty()) {
+        std::fprintf(stderr, "--delta needs a catalog to compare, use --catalog.\n%s", usage);
+        exit(-1);
+    }
 
-            if(buf != 'y') {
-                std::printf("Directory './temp' has to be removed before continuing.\n");
-                return 0;
-            }
-        }
-        std::printf("Removing './temp' directory...\n");
-        std::filesystem::remove_all("./temp");
+    // Catalogs get published, unpacked extensions have no zip size to put in them.
+    if(command == command_type::generate && want_catalog() && std::any_of(input_filepaths.begin(), input_filepaths.end(), [](auto &&f) { return std::filesystem::is_directory(f); })) {
+        std::fprintf(stderr, "Unpacked extension directories cant go into catalogs, zip them first.\n%s", usage);
+        exit(-1);
     }
 
-    // Open the zip file, get all info we can and extract it in 'temp' directory.
-    try {
-        zip_archive ext_zip;
+#ifdef NO_EXT_LOAD
+    // Nothing to load editor mfx files with.
+    if(command == command_type::generate && probe_command.empty() && !no_probe) {
+        std::fprintf(stderr, "This build cant load extensions, use --probe-command <executable> or --no-probe.\n%s", usage);
+        exit(-1);
+    }
+#endif
+
+    if(output_directory.empty()) {
+        output_directory = std::filesystem::current_path();
+    }
 
-        ext_zip.open(ext_zip_filepath);
+    // Generate and watch runs only keep an index if asked to.
+    if(index_filepath.empty() && (command == command_type::index || command == command_type::query)) {
+        index_filepath = output_directory / "manifests.idx";
+    }
 
-        std::vector<std::filesystem::path> files = ext_zip.list_files();
-        zip_file_sanity_check(ext_zip_filepath.stem().string(), files);
+    if(command == command_type::merge && catalog_filepath.empty() && binary_catalog_filepath.empty()) {
+        catalog_filepath = output_directory / "catalog.json";
+    }
 
-        editor_mfx = find_editor_mfx(files);
+    output = std::make_unique<output_writer>(output_directory);
+}
 
-        // Latest modified date
-        guess_mfx_name(&ext_man, editor_mfx);
-        guess_supported_platforms(&ext_man, files);
 
-        for (auto &&e : ext_zip.get_file_entries()) {
-            if(ext_man.time < e.modified_date) {
-                ext_man.time = e.modified_date;
-            }
+void cem_tool::add_input(const std::string& arg) {
+    // Zip files on a http server, read with range requests instead of downloading them.
+    if(command == command_type::generate && is_http_url(arg)) {
+        input_urls.push_back(arg);
+        return;
+    }
+
+    if(arg.starts_with("https://")) {
+        std::fprintf(stderr, "Only http:// urls are supported.\n%s", usage);
+        exit(-1);
+    }
+
+    // If not a flag assume its a path to zip file (or catalog in merge mode).
+    // Make sure provided file path is valid.
+    auto filepath = std::filesystem::absolute(arg);
+
+    if(!std::filesystem::exists(filepath)) {
+        std::fprintf(stderr, "File doesnt exist.\n%s", usage);
+        exit(-1);
+    }
+
+    if(command == command_type::merge || command == command_type::probe) {
+        if(!std::filesystem::is_regular_file(filepath)) {
+            std::fprintf(stderr, "Not a file.\n%s", usage);
+            exit(-1);
         }
 
-        // Seems like original tool adds one second
-        ext_man.time++;
+        input_filepaths.push_back(filepath);
+        return;
+    }
+
+    // Index takes manifests and catalogs.
+    auto input_extension = command == command_type::index ? ".json" : ".zip";
 
-        for (auto &&f : files) {
-            ext_man.files.push_back(f.string());
+    // Unpacked extension is processed as is, like a zip file.
+    if((command == command_type::generate || command == command_type::imports) && is_extension_directory(filepath)) {
+        // 'dir/' has no filename, its needed as extension name.
+        filepath = filepath.lexically_normal();
+        if(!filepath.has_filename()) {
+            filepath = filepath.parent_path();
         }
 
-        ext_zip.extract("temp");
+        input_filepaths.push_back(filepath);
+        return;
     }
-    catch(const std::exception& e) {
-        std::fprintf(stderr, "%s\n", e.what());
-        return -1;
+
+    // Directories are expanded to all zip files (json files for index) they contain.
+    if(std::filesystem::is_directory(filepath)) {
+        std::vector<std::filesystem::path> files;
+
+        for (auto &&e : std::filesystem::directory_iterator(filepath)) {
+            if(e.is_regular_file() && e.path().extension() == input_extension) {
+                files.push_back(e.path());
+            }
+        }
+
+        // directory_iterator order is unspecified.
+        std::sort(files.begin(), files.end());
+        input_filepaths.insert(input_filepaths.end(), files.begin(), files.end());
+        return;
     }
 
-    ext_man.download = ext_man.mfxname;
-    ext_man.zipsize = std::filesystem::file_size(ext_zip_filepath);
+    if(!std::filesystem::is_regular_file(filepath)) {
+        std::fprintf(stderr, "Not a file.\n%s", usage);
+        exit(-1);
+    }
 
+    // Imports also takes editor mfx and dll files.
+    if(command == command_type::index || command == command_type::imports) {
+        input_filepaths.push_back(filepath);
+        return;
+    }
 
-    // Try to load the editor mfx and get more infos.
-    try {
-        fusion::extension ext;
-        ext.open("./temp" / editor_mfx);
+    if(filepath.extension() != ".zip") {
+        std::fprintf(stderr, "Not a zip file.\n%s", usage);
+        exit(-1);
+    }
 
-        ext.Initialize(1);
+    input_filepaths.push_back(filepath);
+}
 
-        ext_man.dev = ext.GetInfos(fusion::ext_general_infos::product) == 3;    // 3 = Developer, 2 = Standard, 1 = TGF.
 
-        fusion::ext_infos infos = {};
-        ext.GetObjInfos(&infos);
-        ext_man.name = infos.name;
-        ext_man.author = infos.author;
-        ext_man.description = infos.comment;
-        ext_man.website = infos.website;
+static std::vector<std::uint8_t> read_file(const std::filesystem::path& filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    std::vector<std::uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-        ext.Free();
+    if(file.bad() || !file.is_open()) {
+        throw create_except("Failed to read '%s'.", filepath.string().c_str());
     }
-    catch(const std::exception& e) {
-        std::fprintf(stderr, "%s\n", e.what());
-        return -1;
+
+    return data;
+}
+
+static void write_file(const std::filesystem::path& filepath, const std::vector<std::uint8_t>& data) {
+    std::filesystem::create_directories(filepath.parent_path());
+    std::ofstream file(filepath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+    if(!file) {
+        throw create_except("Failed to write '%s'.", filepath.string().c_str());
     }
+}
 
 
-    std::string output_filename = ext_man.mfxname + ".json";
-    std::ofstream output(output_filename);
-    output << ext_man.to_json();
-    std::printf("Created '%s', make sure the file is correct.\n", output_filename.c_str());
-    return 0;
+// Directory with the same layout as an extension zip file.
+bool cem_tool::is_extension_directory(const std::filesystem::path& directory) {
+    return std::filesystem::is_directory(directory) && std::filesystem::is_directory(directory / "Extensions");
 }
 
-cem_tool::~cem_tool() {
-    std::fflush(stdout);
-    std::fflush(stderr);
+
+// Shards are picked by zip file name only so every machine agrees no matter where the shared directory is mounted.
+bool cem_tool::in_shard(const std::filesystem::path& ext_zip_filepath) {
+    return stable_hash(ext_zip_filepath.filename().string()) % shard_count == shard_index;
 }
 
 
+int cem_tool::run() {
+    // Rewritten periodically while running, final version and json summary when done.
+    std::unique_ptr<metrics::exporter> metrics_exporter;
+    if(!metrics_filepath.empty()) {
+        metrics_exporter = std::make_unique<metrics::exporter>(metrics_filepath, metrics_interval);
+    }
+
+    if(command == command_type::merge) {
+        return run_merge();
+    }
 
-// Check the zip file structure, make sure:
-// - Ext file names are the same
-// - Directory structure is correct
-// - Required ext files are present
-void cem_tool::zip_file_sanity_check(const std::string& ext_name, const std::vector<std::filesystem::path>& zip_files) {
-    try {
-        // Test all extension runtime and editor files if they have consistent names.
-        // Not realy possible to combine those because capture groups get messed up.
-        const char* name_tests[] = {
-            "Extensions/(?:Unicode/|HWA/)?(.*)\\.mfx",
-            "Data/Runtime/(?:Unicode/|HWA/)?(.*)\\.mfx",
-            "Data/Runtime/Flash/(.*)\\.zip",
-            "Data/Runtime/Android/(.*)\\.zip",
-            "Data/Runtime/iPhone/(.*)\\.ext",
-            "Data/Runtime/Html5/(.*)\\.js",
-            "Data/Runtime/Wua/js/runtime/extensions/source/(.*)\\.js",
-            "Data/Runtime/Mac/(.*)\\.dat",
-            "Data/Runtime/XNA/(?:Phone|Windows|Xbox)/(.*)\\.zip",
-        };
+    if(command == command_type::probe) {
+        return run_probe();
+    }
 
-        for (auto &&t : name_tests) {
-            std::smatch match;
-            std::regex test(t);
+    if(command == command_type::index) {
+        return run_index();
+    }
 
-            for (auto &&f : zip_files) {
-                auto filepath = f.string();
+    if(command == command_type::query) {
+        return run_query();
+    }
 
-                if(std::regex_search(filepath, match, test) && match[1] != ext_name) {
-                    throw create_except("Bad zip file structure: File '%s' is named '%s' but expected '%s'.", filepath.c_str(), match[1].str().c_str(), ext_name.c_str());
-                }
+    if(command == command_type::repack) {
+        return run_repack();
+    }
+
+    if(command == command_type::imports) {
+        return run_imports();
+    }
+
+    if(command == command_type::similar) {
+        return run_similar();
+    }
+
+    if(!watch_directory.empty()) {
+        return run_watch();
+    }
+
+    return run_generate();
+}
+
+
+// Returns false if user doesnt want to remove it.
+bool cem_tool::remove_temp_directory() {
+    if(std::filesystem::exists("./temp")) {
+        std::printf("Directory './temp' already exists.\n");
+        if(!yes) {
+            std::printf("Delete './temp' directory? [y/n] ");
+
+            char buf;
+            std::scanf("%c", &buf);
+
+            if(buf != 'y') {
+                std::printf("Directory './temp' has to be removed before continuing.\n");
+                return false;
             }
         }
+        std::printf("Removing './temp' directory...\n");
+        std::filesystem::remove_all("./temp");
+    }
 
-        // Check directories in zip file, all must be matched by that massive regex bellow.
-        // Create a copy of the path so the actual array contents stay the same.
-        for (auto f : zip_files) {
-            auto directory = f.remove_filename().string();
-            bool match = false;
+    return true;
+}
 
-            // ...
-            std::regex test("Extensions/(Unicode/|HWA/)?|Data/Runtime/((Unicode/|HWA/)?|Flash/|Android/|iPhone/|Html5/|Wua/js/runtime/extensions/source/|Mac/|XNA/(Phone|Windows|Xbox)/)|Examples/(.*)?|Help/(.*)?");
-            if(!std::regex_match(directory, test)) {
-                throw create_except("Bad zip file structure: Directory '%s' was not recognized, typo?", directory.c_str());
-            }
+int cem_tool::run_generate() {
+    if(!remove_temp_directory()) {
+        return 0;
+    }
+
+    std::vector<std::filesystem::path> ext_zip_filepaths;
+    std::vector<std::filesystem::path> ext_directories;
+    for (auto &&f : input_filepaths) {
+        if(!in_shard(f)) {
+            continue;
         }
 
-        // Check if any editor .mfx is present in Extensions/
-        bool match = false;
+        if(std::filesystem::is_directory(f)) {
+            ext_directories.push_back(f);
+        } else {
+            ext_zip_filepaths.push_back(f);
+        }
+    }
 
-        std::regex editor_mfx_regex("Extensions/(Unicode/|HWA/)?.*\\.mfx");
-        for (auto &&f : zip_files) {
-            auto filepath = f.string();
-            if(std::regex_match(filepath, editor_mfx_regex)) {
-                match = true;
-                break;
-            }
+    std::vector<std::string> ext_zip_urls;
+    for (auto &&u : input_urls) {
+        if(in_shard(http_file(u).filename())) {
+            ext_zip_urls.push_back(u);
         }
+    }
+
+    size_t input_count = ext_zip_filepaths.size() + ext_directories.size() + ext_zip_urls.size();
+
+    if(shard_count > 1) {
+        std::printf("Shard %llu/%llu: %zu of %zu zip files.\n", (unsigned long long)shard_index + 1, (unsigned long long)shard_count, input_count, input_filepaths.size() + input_urls.size());
+    }
+
+    catalog ext_catalog;
+    std::atomic<size_t> failed = 0;
+    std::mutex output_mutex;        // Catalog and manifest files
+    std::vector<std::filesystem::path> manifest_filepaths;      // Written, for --index
 
-        if(!match) {
-            throw std::exception("Bad zip file structure: The zip file doesnt contain any editor .mfx file.");
+    // Same for zip files, urls and unpacked directories.
+    auto add_manifest = [&](const std::filesystem::path& input, auto &&process) {
+        if(input_filepaths.size() + input_urls.size() > 1) {
+            std::printf("Processing '%s'...\n", input.filename().string().c_str());
         }
 
-        // Check if at least one runtime extension file is present in Data/Runtime/
-        match = false;
+        try {
+            metrics::stage_timer timer(metrics::stage::archive);
+            auto ext_man = process();
 
-        std::regex runtime_mfx_regex("Data/Runtime/((Unicode/|HWA/)?.*\\.mfx|Flash/.*\\.zip|Android/.*\\.zip|iPhone/.*\\.ext|Html5/.*\\.js|Wua/js/runtime/extensions/source/.*\\.js|Mac/.*\\.dat|XNA/(Phone|Windows|Xbox)/.*\\.zip)");
-        for (auto &&f : zip_files) {
-            auto filepath = f.string();
-            if(std::regex_match(filepath, runtime_mfx_regex)) {
-                match = true;
-                break;
+            std::lock_guard lock(output_mutex);
+            if(want_catalog()) {
+                ext_catalog.add(std::move(ext_man), input.string());
+            } else {
+                manifest_filepaths.push_back(write_manifest(ext_man));
             }
+
+            metrics::add(metrics::counter::archives_processed);
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            metrics::add(metrics::counter::archives_failed);
+            failed++;
         }
+    };
+
+    // Central directories are read ahead for many zip files at once, processed in order they are ready.
+    zip_prefetcher prefetcher(ext_zip_filepaths, prefetch_queue_depth);
+
+    // Directories first, then zip files, then urls. Work gets the temp directory of the worker.
+    using batch_work = std::function<void(const std::filesystem::path& temp_directory)>;
+    std::mutex input_mutex;
+    size_t next_directory = 0;
+    size_t next_url = 0;
+
+    auto next_input = [&](batch_work* work, size_t* backlog) {
+        std::lock_guard lock(input_mutex);
+        *backlog = prefetcher.backlog();
 
-        if(!match) {
-            throw std::exception("Bad zip file structure: The zip file doesnt contain any runtime extension file.");
+        if(next_directory < ext_directories.size()) {
+            auto &&d = ext_directories[next_directory++];
+            *work = [&](const std::filesystem::path&) { add_manifest(d, [&]() { return process_directory(d); }); };
+            return true;
         }
-    }
-    catch(const std::exception& e) {
-        if(ignore_zip_sanity_check_errors) {
-            std::fprintf(stderr, "(ignored) %s\n", e.what());
+
+        zip_central_directory central_directory;
+        if(prefetcher.next(&central_directory)) {
+            *work = [&, central_directory = std::move(central_directory)](const std::filesystem::path& temp_directory) {
+                add_manifest(central_directory.file_path, [&]() { return process_zip(central_directory, temp_directory); });
+            };
+            return true;
         }
-        else {
-            throw;
+
+        if(next_url < ext_zip_urls.size()) {
+            auto &&u = ext_zip_urls[next_url++];
+            *work = [&](const std::filesystem::path& temp_directory) { add_manifest(u, [&]() { return process_url(u, temp_directory); }); };
+            return true;
         }
-    }
-}
 
+        return false;
+    };
 
-void cem_tool::guess_mfx_name(fusion::cem_ext_manifest* ext_man, const std::filesystem::path& editor_mfx_path) {
-    std::regex mfx_name_regex(".*/(.*)\\.mfx");         // Get mfxname from editor .mfx
-    std::smatch match;
+    // Workers above the current limit wait in acquire().
+    concurrency_controller controller(min_jobs, jobs);
 
-    auto filepath = editor_mfx_path.string();
+    auto worker = [&](unsigned index) {
+        auto temp_directory = std::filesystem::path("./temp") / std::to_string(index);
+        controller.observe_thread();
 
-    if(std::regex_search(filepath, match, mfx_name_regex)) {
-        ext_man->mfxname = match[1];
-    }
-}
+        while(true) {
+            controller.acquire();
+
+            batch_work work;
+            size_t backlog;
+            auto wait_start = std::chrono::steady_clock::now();
+            bool has_work = next_input(&work, &backlog);
+            controller.add_input_wait(std::chrono::steady_clock::now() - wait_start, backlog);
 
-void cem_tool::guess_supported_platforms(fusion::cem_ext_manifest* ext_man, const std::vector<std::filesystem::path>& zip_files) {
-    // Matches fusion::platform enum
-    const char* tests[] = {
-        "Data/Runtime/(Unicode/|HWA/)?.*\\.mfx",
-        "Data/Runtime/Flash/.*\\.zip",
-        "Data/Runtime/Android/.*\\.zip",
-        "Data/Runtime/iPhone/.*\\.ext",
-        "Data/Runtime/Html5/.*\\.js",
-        "Data/Runtime/Wua/js/runtime/extensions/source/.*\\.js",
-        "Data/Runtime/Mac/.*\\.dat",
-        "Data/Runtime/XNA/(Phone|Windows|Xbox)/.*\\.zip",
+            if(!has_work) {
+                controller.release(false);
+                return;
+            }
+
+            work(temp_directory);
+            controller.release(true);
+        }
     };
 
-    std::uint32_t supported_platforms = 0;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < std::min<size_t>(jobs, input_count); i++) {
+        workers.emplace_back(worker, i);
+    }
 
-    for (size_t i = 0; i < 8; i++) {
-        std::regex regex(tests[i]);
+    for (auto &&w : workers) {
+        w.join();
+    }
 
-        for (auto &&f : zip_files) {
-            auto filepath = f.string();
+    try {
+        if(want_catalog()) {
+            save_catalog(ext_catalog);
+        }
+        output->commit();
 
-            if(std::regex_match(filepath, regex)) {
-                supported_platforms |= fusion::platform_index_to_enum(i);
-                break;
+        // Catalog replaces the manifests, binary catalogs cant be indexed.
+        if(!index_filepath.empty()) {
+            if(!catalog_filepath.empty()) {
+                manifest_filepaths = {catalog_filepath};
             }
+
+            manifest_index index;
+            load_index(&index);
+            update_index(&index, manifest_filepaths);
+        }
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    if(output->unchanged() > 0) {
+        std::printf("%zu of %zu files didnt change and were left alone.\n", output->unchanged(), output->unchanged() + output->written());
+    }
+
+    if(failed) {
+        if(input_count > 1) {
+            std::fprintf(stderr, "Failed to process %zu of %zu zip files.\n", failed.load(), input_count);
         }
+        return -1;
     }
 
-    if(!supported_platforms) {
-        throw std::exception("No platforms supported? Bad file structure?");
+    return 0;
+}
+
+
+std::filesystem::path cem_tool::write_manifest(const fusion::cem_ext_manifest& ext_man) {
+    metrics::stage_timer timer(metrics::stage::write);
+    auto manifest_filepath = output->resolve(ext_man.mfxname + ".json");
+
+    if(write_output(manifest_filepath, ext_man.to_json())) {
+        std::printf("Created '%s', make sure the file is correct.\n", manifest_filepath.filename().string().c_str());
+    } else {
+        std::printf("'%s' didnt change.\n", manifest_filepath.filename().string().c_str());
     }
 
-    ext_man->platforms = supported_platforms;
+    return manifest_filepath;
 }
 
 
-std::filesystem::path cem_tool::find_editor_mfx(const std::vector<std::filesystem::path>& zip_files) {
-    std::regex editor_mfx_regex("Extensions/(Unicode/|HWA/)?.*\\.mfx");
+static std::filesystem::path compressed_copy(const std::filesystem::path& filepath, precompress_format format) {
+    auto compressed_filepath = filepath;
+    compressed_filepath += precompress_extension(format);
+    return compressed_filepath;
+}
 
-    for (auto &&f : zip_files) {
-        auto filepath = f.string();
+// Writes data and its compressed copies next to it, returns false if data didnt change.
+bool cem_tool::write_output(const std::filesystem::path& filepath, std::string_view data) {
+    bool changed = output->write(filepath, data);
 
-        if(std::regex_match(filepath, editor_mfx_regex)) {
-            return filepath;
+    // Copies of unchanged files are only compressed again if missing, like when --gzip is new.
+    for (auto &&format : precompress_formats) {
+        auto compressed_filepath = compressed_copy(filepath, format);
+
+        std::error_code ec;
+        if(changed || !std::filesystem::exists(output->resolve(compressed_filepath), ec)) {
+            output->write(compressed_filepath, precompress(data, format, jobs));
         }
     }
 
-    throw std::exception("No editor .mfx file? Bad file structure?");
-}
\ No newline at end of file
+    return changed;
+}
+
+// Removes file and every compressed copy, also of formats not enabled in this run. Returns false if file didnt exist.
+bool cem_tool::remove_output(const std::filesystem::path& filepath) {
+    std::error_code ec;
+    for (auto &&format : {precompress_format::gzip, precompress_format::zstd}) {
+        std::filesystem::remove(compressed_copy(filepath, format), ec);
+    }
+    return std::filesystem::remove(filepath, ec);
+}
+
+
+int cem_tool::run_watch() {
+    if(!remove_temp_directory()) {
+        return 0;
+    }
+
+    // Which manifest belongs to which zip file, so it can be removed with the zip file.
+    // Zip files already there only get their central directory read to know their mfx name.
+    std::map<std::filesystem::path, std::filesystem::path> watched_manifests;
+    manifest_index index;
+
+    try {
+        if(!index_filepath.empty()) {
+            load_index(&index);
+        }
+
+        directory_watcher watcher(watch_directory);
+
+        std::vector<std::filesystem::path> ext_zip_filepaths;
+        for (auto &&e : std::filesystem::directory_iterator(watch_directory)) {
+            if(e.is_regular_file() && e.path().extension() == ".zip" && in_shard(e.path())) {
+                ext_zip_filepaths.push_back(e.path());
+            }
+        }
+
+        zip_prefetcher prefetcher(ext_zip_filepaths, prefetch_queue_depth);
+        zip_central_directory central_directory;
+
+        while(prefetcher.next(&central_directory)) {
+            try {
+                zip_archive ext_zip;
+                if(central_directory.error.empty()) {
+                    ext_zip.open_central_directory(central_directory.data);
+                } else {
+                    ext_zip.open(central_directory.file_path);
+                }
+
+                fusion::cem_ext_manifest ext_man = {};
+                guess_mfx_name(&ext_man, find_editor_mfxs(ext_zip.list_files()).front());
+                watched_manifests[central_directory.file_path] = output->resolve(ext_man.mfxname + ".json");
+            }
+            catch(const std::exception&) {
+                // Reported once it changes and gets processed.
+            }
+        }
+
+        std::printf("Watching '%s' for zip file changes (%zu zip files)...\n", watch_directory.string().c_str(), watched_manifests.size());
+        std::fflush(stdout);
+
+        while(true) {
+            std::vector<std::filesystem::path> changed;
+            std::vector<std::filesystem::path> manifest_filepaths;      // Written, for --index
+            bool removed = false;
+
+            for (auto &&e : watcher.wait(watch_debounce, watch_max_wait)) {
+                if(e.file_path.extension() != ".zip" || !in_shard(e.file_path)) {
+                    continue;
+                }
+
+                // Moved in and out again while debouncing, or removed after being modified.
+                if(!e.removed && std::filesystem::is_regular_file(e.file_path)) {
+                    changed.push_back(e.file_path);
+                    continue;
+                }
+
+                auto it = watched_manifests.find(e.file_path);
+                if(it == watched_manifests.end()) {
+                    continue;
+                }
+
+                if(remove_output(it->second)) {
+                    std::printf("Removed '%s', '%s' was deleted.\n", it->second.filename().string().c_str(), e.file_path.filename().string().c_str());
+                    removed = true;
+                }
+                watched_manifests.erase(it);
+            }
+
+            zip_prefetcher prefetcher(changed, prefetch_queue_depth);
+
+            while(prefetcher.next(&central_directory)) {
+                auto &&ext_zip_filepath = central_directory.file_path;
+                std::printf("Processing '%s'...\n", ext_zip_filepath.filename().string().c_str());
+
+                try {
+                    metrics::stage_timer timer(metrics::stage::archive);
+                    auto manifest_filepath = write_manifest(process_zip(central_directory, "./temp"));
+                    metrics::add(metrics::counter::archives_processed);
+
+                    // Mfx name changed, old manifest is stale.
+                    auto it = watched_manifests.find(ext_zip_filepath);
+                    if(it != watched_manifests.end() && it->second != manifest_filepath) {
+                        removed |= remove_output(it->second);
+                    }
+
+                    watched_manifests[ext_zip_filepath] = manifest_filepath;
+                    manifest_filepaths.push_back(manifest_filepath);
+                }
+                catch(const std::exception& e) {
+                    std::fprintf(stderr, "%s\n", e.what());
+                    metrics::add(metrics::counter::archives_failed);
+                }
+            }
+
+            try {
+                output->commit();
+
+                if(!index_filepath.empty() && (removed || !manifest_filepaths.empty())) {
+                    update_index(&index, manifest_filepaths);
+                }
+            }
+            catch(const std::exception& e) {
+                std::fprintf(stderr, "%s\n", e.what());
+            }
+
+            // Output usually goes to a log file, dont keep it buffered while waiting.
+            std::fflush(stdout);
+        }
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int cem_tool::run_merge() {
+    try {
+        catalog merged;
+
+        for (auto &&f : input_filepaths) {
+            merged.load(f);
+        }
+
+        std::printf("Merging %zu catalogs...\n", input_filepaths.size());
+        save_catalog(merged);
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+
+bool cem_tool::want_catalog() {
+    return !catalog_filepath.empty() || !binary_catalog_filepath.empty();
+}
+
+void cem_tool::save_catalog(catalog& ext_catalog) {
+    metrics::stage_timer timer(metrics::stage::write);
+    ext_catalog.finalize();
+
+    // Loaded before anything is written, --delta is usually the catalog that is about to be replaced.
+    catalog previous;
+    if(!delta_base_filepath.empty()) {
+        previous.load(delta_base_filepath);
+        previous.finalize();
+    }
+
+    if(!catalog_filepath.empty()) {
+        write_output(catalog_filepath, ext_catalog.to_json());
+        std::printf("Created '%s' with %zu extensions, make sure the file is correct.\n", catalog_filepath.string().c_str(), ext_catalog.entries().size());
+    }
+
+    if(!binary_catalog_filepath.empty()) {
+        output->write(binary_catalog_filepath, binary_catalog::serialize(ext_catalog.entries()));
+        std::printf("Created '%s' with %zu extensions.\n", binary_catalog_filepath.string().c_str(), ext_catalog.entries().size());
+    }
+
+    if(!delta_base_filepath.empty()) {
+        size_t added, removed, changed;
+        auto delta = ext_catalog.delta_json(previous, &added, &removed, &changed);
+
+        auto delta_filepath = catalog_filepath.empty() ? binary_catalog_filepath : catalog_filepath;
+        delta_filepath.replace_extension(".delta.json");
+
+        write_output(delta_filepath, delta);
+        std::printf("Created '%s': %zu added, %zu removed, %zu changed.\n", delta_filepath.string().c_str(), added, removed, changed);
+    }
+
+    output->commit();
+}
+
+
+// Index has to exist before it can be updated, a new one is fine.
+void cem_tool::load_index(manifest_index* index) {
+    if(std::filesystem::exists(index_filepath)) {
+        index->load(index_filepath);
+    }
+}
+
+// Manifests written by generate and watch runs go into --index as soon as they are on disk.
+void cem_tool::update_index(manifest_index* index, const std::vector<std::filesystem::path>& sources) {
+    metrics::stage_timer timer(metrics::stage::write);
+    size_t removed = index->remove_missing_sources();
+    size_t updated = 0;
+
+    for (auto &&s : sources) {
+        if(index->update_source(s)) {
+            updated++;
+        }
+    }
+
+    output->write(index_filepath, index->to_msgpack());
+    output->commit();
+    std::printf("Indexed %zu extensions in '%s': %zu files updated, %zu removed.\n", index->size(), index_filepath.string().c_str(), updated, removed);
+}
+
+
+int cem_tool::run_probe() {
+    try {
+        auto probe = fusion::probe_extension(input_filepaths.front(), run_infos);
+        std::printf("%s\n", probe.to_json().c_str());
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int cem_tool::run_index() {
+    manifest_index index;
+    size_t updated = 0, unchanged = 0, failed = 0, removed = 0;
+
+    try {
+        load_index(&index);
+        removed = index.remove_missing_sources();
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    // Files indexed before are checked for changes too.
+    auto sources = index.source_paths();
+    for (auto &&f : input_filepaths) {
+        if(std::find(sources.begin(), sources.end(), f) == sources.end()) {
+            sources.push_back(f);
+        }
+    }
+
+    for (auto &&f : sources) {
+        try {
+            if(index.update_source(f)) {
+                updated++;
+            } else {
+                unchanged++;
+            }
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            failed++;
+        }
+    }
+
+    try {
+        metrics::stage_timer timer(metrics::stage::write);
+        output->write(index_filepath, index.to_msgpack());
+        output->commit();
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    std::printf("Indexed %zu extensions in '%s': %zu files updated, %zu unchanged, %zu removed.\n", index.size(), index_filepath.string().c_str(), updated, unchanged, removed);
+    return failed ? -1 : 0;
+}
+
+int cem_tool::run_query() {
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        manifest_index index;
+        index.load(index_filepath);
+        auto results = index.query(query_terms);
+
+        auto duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+        for (auto &&r : results) {
+            std::printf("%s\n", r.c_str());
+        }
+        std::fprintf(stderr, "%zu of %zu extensions match (%.1f ms).\n", results.size(), index.size(), duration.count());
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int cem_tool::run_repack() {
+    size_t failed = 0;
+    std::set<std::filesystem::path> outputs;
+
+    for (auto &&input : input_filepaths) {
+        auto output = output_filepath;
+        auto output_name = input.stem().string() + "-repacked.zip";
+        if(output.empty()) {
+            output = std::filesystem::absolute(output_name);
+        } else if(!output.has_filename() || std::filesystem::is_directory(output)) {
+            output /= output_name;
+        }
+
+        // Zip files with the same name from different directories.
+        if(!outputs.insert(output.lexically_normal()).second) {
+            std::fprintf(stderr, "Not repacking '%s', '%s' was already written in this run.\n", input.string().c_str(), output.string().c_str());
+            failed++;
+            continue;
+        }
+
+        try {
+            std::filesystem::create_directories(output.parent_path());
+
+            auto start = std::chrono::steady_clock::now();
+            auto entries = zip_repack(input, output, compress_level, jobs);
+            auto duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+            std::uint64_t total_uncompressed = 0, total_compressed = 0;
+
+            std::printf("Repacked '%s' to '%s':\n", input.filename().string().c_str(), output.string().c_str());
+            for (auto &&e : entries) {
+                double ratio = e.uncompressed_size ? 100.0 * e.compressed_size / e.uncompressed_size : 100.0;
+                std::printf("  %6.1f%% %12llu -> %12llu  %s\n", ratio, (unsigned long long)e.uncompressed_size, (unsigned long long)e.compressed_size, e.filepath.c_str());
+
+                total_uncompressed += e.uncompressed_size;
+                total_compressed += e.compressed_size;
+            }
+
+            double total_ratio = total_uncompressed ? 100.0 * total_compressed / total_uncompressed : 100.0;
+            std::printf("  %6.1f%% %12llu -> %12llu  %zu files, %.2f s on %u threads, zip file %llu -> %llu bytes\n", total_ratio, (unsigned long long)total_uncompressed, (unsigned long long)total_compressed, entries.size(), duration.count(), jobs, (unsigned long long)std::filesystem::file_size(input), (unsigned long long)std::filesystem::file_size(output));
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            failed++;
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+
+// Re-uploads and forks are often renamed, so the extension name in paths doesnt count.
+static std::uint64_t file_feature(std::string_view filepath, const zip_file_stat& stat, const std::string& ext_name) {
+    std::string key;
+
+    for (size_t i = 0; i < filepath.size();) {
+        if(!ext_name.empty() && filepath.substr(i).starts_with(ext_name)) {
+            key += '*';
+            i += ext_name.size();
+        } else {
+            key += filepath[i++];
+        }
+    }
+
+    key += '\0' + std::to_string(stat.uncompressed_size) + '\0' + std::to_string(stat.crc);
+    return stable_hash(key);
+}
+
+// Only central directories are read, nothing is decompressed.
+int cem_tool::run_similar() {
+    struct fingerprint {
+        std::filesystem::path ext_zip_filepath;
+        minhash_signature signature;
+    };
+
+    std::vector<fingerprint> fingerprints;
+    size_t failed = 0;
+
+    zip_prefetcher prefetcher(input_filepaths, prefetch_queue_depth);
+    zip_central_directory central_directory;
+
+    while(prefetcher.next(&central_directory)) {
+        try {
+            zip_archive ext_zip;
+            if(central_directory.error.empty()) {
+                ext_zip.open_central_directory(central_directory.data);
+            } else {
+                ext_zip.open(central_directory.file_path);
+            }
+
+            auto ext_name = central_directory.file_path.stem().string();
+            std::vector<std::uint64_t> features;
+
+            ext_zip.for_each_file([&](std::string_view filepath, const zip_file_stat& stat) {
+                features.push_back(file_feature(filepath, stat, ext_name));
+            });
+
+            // Empty zip files would all look the same.
+            if(!features.empty()) {
+                fingerprints.push_back({central_directory.file_path, minhash(features)});
+            }
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "%s: %s\n", central_directory.file_path.filename().string().c_str(), e.what());
+            failed++;
+        }
+    }
+
+    // Prefetcher returns zip files in order they were read.
+    std::sort(fingerprints.begin(), fingerprints.end(), [](const fingerprint& a, const fingerprint& b) {
+        return a.ext_zip_filepath < b.ext_zip_filepath;
+    });
+
+    std::vector<minhash_signature> signatures;
+    for (auto &&f : fingerprints) {
+        signatures.push_back(f.signature);
+    }
+
+    auto clusters = minhash_clusters(signatures, similar_threshold);
+
+    size_t similar = 0;
+    for (auto &&c : clusters) {
+        auto &&first = fingerprints[c.front()];
+        std::printf("'%s':\n", first.ext_zip_filepath.filename().string().c_str());
+
+        for (size_t i = 1; i < c.size(); i++) {
+            auto &&other = fingerprints[c[i]];
+            std::printf("  %4.2f '%s'\n", minhash_similarity(first.signature, other.signature), other.ext_zip_filepath.filename().string().c_str());
+        }
+
+        similar += c.size();
+    }
+
+    std::printf("%zu groups, %zu of %zu zip files are similar to another one.\n", clusters.size(), similar, fingerprints.size());
+    return failed ? -1 : 0;
+}
+
+
+// Same import checks generate does before loading editor mfxs, without loading anything.
+int cem_tool::run_imports() {
+    size_t failed = 0;
+
+    for (auto &&input : input_filepaths) {
+        try {
+            path_table files;
+            std::vector<std::filesystem::path> editor_mfxs;
+            std::function<std::vector<std::uint8_t>(const std::string& path)> read;
+            zip_archive ext_zip;
+
+            if(std::filesystem::is_directory(input)) {
+                files = scan_directory(input, nullptr, jobs);
+                editor_mfxs = find_editor_mfxs(files);
+                read = [&](const std::string& path) { return read_file(input / path); };
+            } else if(input.extension() == ".zip") {
+                ext_zip.open(input);
+                files = ext_zip.list_files();
+                editor_mfxs = find_editor_mfxs(files);
+                read = [&](const std::string& path) { return ext_zip.read_entry(path); };
+            } else {
+                // Single mfx or dll, files next to it count as bundled.
+                for (auto &&e : std::filesystem::directory_iterator(input.parent_path())) {
+                    if(e.is_regular_file()) {
+                        files.push_back(e.path().filename().string());
+                    }
+                }
+                editor_mfxs = {input.filename()};
+                read = [&](const std::string& path) { return read_file(input.parent_path() / path); };
+            }
+
+            std::printf("'%s':\n", input.filename().string().c_str());
+
+            for (auto &&mfx : editor_mfxs) {
+                std::printf("  %s\n", mfx.generic_string().c_str());
+
+                try {
+                    for (auto &&i : resolve_imports(mfx.generic_string(), files, read)) {
+                        std::printf("    %-8s %s", import_kind_name(i.kind), i.dll.c_str());
+
+                        if(i.kind == import_kind::bundled) {
+                            std::printf("  (%s)", i.bundled_path.c_str());
+                        }
+
+                        if(i.imported_by != mfx.generic_string()) {
+                            std::printf("  imported by %s", i.imported_by.c_str());
+                        }
+
+                        std::printf("\n");
+
+                        if(i.kind == import_kind::missing) {
+                            failed++;
+                        }
+                    }
+                }
+                catch(const std::exception& e) {
+                    std::fprintf(stderr, "    %s\n", e.what());
+                    failed++;
+                }
+            }
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            failed++;
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+
+fusion::cem_ext_manifest cem_tool::process_zip(const zip_central_directory& central_directory, const std::filesystem::path& temp_directory) {
+    auto &&ext_zip_filepath = central_directory.file_path;
+    fusion::cem_ext_manifest ext_man = {};
+    std::vector<std::filesystem::path> editor_mfxs;     // Used to get mfx name and get loaded later, preferred one first.
+
+    // Left over from the previous zip file of this worker in batch mode.
+    std::filesystem::remove_all(temp_directory);
+
+    // Open the zip file, get all info we can and extract it in temp directory.
+    {
+        zip_archive ext_zip;
+
+        // If prefetch failed let minizip open it and report what is wrong.
+        {
+            metrics::stage_timer timer(metrics::stage::open);
+
+            if(central_directory.error.empty()) {
+                ext_zip.open_central_directory(central_directory.data);
+            } else {
+                ext_zip.open(ext_zip_filepath);
+            }
+        }
+
+        // Only central directory was read so far, whole file is needed to read entries.
+        editor_mfxs = process_archive(&ext_man, &ext_zip, ext_zip_filepath.stem().string(), temp_directory, [&]() {
+            ext_zip.open(ext_zip_filepath);
+        });
+    }
+
+    ext_man.download = ext_man.mfxname;
+    ext_man.zipsize = std::filesystem::file_size(ext_zip_filepath);
+
+    probe_manifest(&ext_man, temp_directory, editor_mfxs);
+    return ext_man;
+}
+
+
+// Same as a zip file, only end of the file and editor mfxs with their dlls are downloaded.
+fusion::cem_ext_manifest cem_tool::process_url(const std::string& ext_zip_url, const std::filesystem::path& temp_directory) {
+    fusion::cem_ext_manifest ext_man = {};
+    std::vector<std::filesystem::path> editor_mfxs;
+
+    std::filesystem::remove_all(temp_directory);
+
+    {
+        zip_archive ext_zip;
+
+        {
+            metrics::stage_timer timer(metrics::stage::open);
+            ext_zip.open_url(ext_zip_url);
+        }
+
+        editor_mfxs = process_archive(&ext_man, &ext_zip, std::filesystem::path(http_file(ext_zip_url).filename()).stem().string(), temp_directory, []() {});
+
+        ext_man.zipsize = ext_zip.url_size();
+        std::printf("Downloaded %llu of %llu bytes.\n", (unsigned long long)ext_zip.url_downloaded(), (unsigned long long)ext_zip.url_size());
+    }
+
+    ext_man.download = ext_man.mfxname;
+
+    probe_manifest(&ext_man, temp_directory, editor_mfxs);
+    return ext_man;
+}
+
+
+// Listing, structure checks and everything guessed from file paths is one pass over the central directory,
+// then only editor mfxs and dlls they need are extracted to temp directory to load them.
+std::vector<std::filesystem::path> cem_tool::process_archive(fusion::cem_ext_manifest* ext_man, zip_archive* ext_zip, const std::string& ext_name, const std::filesystem::path& temp_directory, const std::function<void()>& open_entries) {
+    ext_checker checker(ext_name, ignore_zip_sanity_check_errors, footprint);
+    {
+        metrics::stage_timer timer(metrics::stage::list);
+        ext_zip->for_each_file([&](std::string_view filepath, const zip_file_stat& stat) {
+            ext_man->files.push_back(filepath);
+            checker.add(filepath, stat);
+        });
+    }
+
+    auto editor_mfxs = finish_checks(ext_man, &checker);
+
+    if(!no_probe) {
+        metrics::stage_timer timer(metrics::stage::extract);
+        open_entries();
+
+        // Files are read once for import checks and staging.
+        std::map<std::string, std::vector<std::uint8_t>> read_files;
+        auto read_file = [&](const std::string& path) -> const std::vector<std::uint8_t>& {
+            auto it = read_files.find(path);
+            if(it == read_files.end()) {
+                it = read_files.emplace(path, ext_zip->read_entry(path)).first;
+            }
+            return it->second;
+        };
+
+        auto imports = check_imports(&editor_mfxs, ext_man->files, read_file);
+
+        // Bundled dlls go next to the mfx, loader looks there first.
+        for (size_t i = 0; i < editor_mfxs.size(); i++) {
+            write_file(temp_directory / editor_mfxs[i], read_file(editor_mfxs[i].generic_string()));
+
+            for (auto &&import : imports[i]) {
+                if(import.kind == import_kind::bundled) {
+                    write_file(temp_directory / editor_mfxs[i].parent_path() / std::filesystem::path(import.bundled_path).filename(), read_file(import.bundled_path));
+                }
+            }
+        }
+    }
+
+    return editor_mfxs;
+}
+
+
+// Same as a zip file, but nothing has to be extracted, editor mfx is loaded where it is.
+fusion::cem_ext_manifest cem_tool::process_directory(const std::filesystem::path& ext_directory) {
+    fusion::cem_ext_manifest ext_man = {};
+
+    std::vector<zip_file_stat> stats;
+    {
+        metrics::stage_timer timer(metrics::stage::list);
+        ext_man.files = scan_directory(ext_directory, &stats, jobs);
+    }
+
+    ext_checker checker(ext_directory.filename().string(), ignore_zip_sanity_check_errors, footprint);
+    for (size_t i = 0; i < ext_man.files.size(); i++) {
+        checker.add(ext_man.files[i], stats[i]);
+    }
+
+    auto editor_mfxs = finish_checks(&ext_man, &checker);
+
+    // Bundled dlls have to be next to the mfx already, nothing is staged here.
+    if(!no_probe) {
+        metrics::stage_timer timer(metrics::stage::extract);
+        check_imports(&editor_mfxs, ext_man.files, [&](const std::string& path) {
+            return read_file(ext_directory / path);
+        });
+    }
+
+    ext_man.download = ext_man.mfxname;
+    ext_man.zipsize = 0;        // Not zipped yet, manifest has to be generated again from the zip file.
+    std::fprintf(stderr, "'%s' is not zipped, zipsize is 0. Generate the manifest from the zip file before publishing it.\n", ext_directory.filename().string().c_str());
+
+    probe_manifest(&ext_man, ext_directory, editor_mfxs);
+    return ext_man;
+}
+
+
+// Required files and mfx name, returns editor mfxs, preferred one first.
+std::vector<std::filesystem::path> cem_tool::finish_checks(fusion::cem_ext_manifest* ext_man, ext_checker* checker) {
+    metrics::stage_timer timer(metrics::stage::sanity_check);
+    auto editor_mfxs = checker->finish(ext_man);
+    guess_mfx_name(ext_man, editor_mfxs.front());
+    return editor_mfxs;
+}
+
+
+// Variants that miss dlls (or arent valid dlls) are reported and left out instead of failing to load later.
+// Returns imports of each remaining variant.
+std::vector<std::vector<pe_import>> cem_tool::check_imports(std::vector<std::filesystem::path>* editor_mfxs, const path_table& files, const std::function<std::vector<std::uint8_t>(const std::string& path)>& read_file) {
+    std::vector<std::filesystem::path> loadable;
+    std::vector<std::vector<pe_import>> ret;
+
+    for (auto &&mfx : *editor_mfxs) {
+        try {
+            auto imports = resolve_imports(mfx.generic_string(), files, read_file);
+
+            for (auto &&i : imports) {
+                if(i.kind == import_kind::missing) {
+                    throw create_except("Missing '%s' imported by '%s'.", i.dll.c_str(), i.imported_by.c_str());
+                }
+            }
+
+            loadable.push_back(mfx);
+            ret.push_back(std::move(imports));
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "Not loading '%s': %s\n", mfx.string().c_str(), e.what());
+        }
+    }
+
+    if(loadable.empty()) {
+        throw std::runtime_error("No editor .mfx file can be loaded.");
+    }
+
+    *editor_mfxs = std::move(loadable);
+    return ret;
+}
+
+
+// Load the editor mfx variants from base_directory and get more infos.
+void cem_tool::probe_manifest(fusion::cem_ext_manifest* ext_man, const std::filesystem::path& base_directory, const std::vector<std::filesystem::path>& editor_mfxs) {
+    if(no_probe) {
+        ext_man->name = ext_man->mfxname;
+        return;
+    }
+
+    metrics::stage_timer timer(metrics::stage::probe);
+    auto probe = probe_editor_mfxs(base_directory, editor_mfxs);
+
+    ext_man->dev = probe.product == 3;    // 3 = Developer, 2 = Standard, 1 = TGF.
+    ext_man->name = probe.infos.name;
+    ext_man->author = probe.infos.author;
+    ext_man->description = probe.infos.comment;
+    ext_man->website = probe.infos.website;
+
+    // Same probe, no extra load.
+    if(run_infos) {
+        ext_man->run_infos = probe.run_infos;
+    }
+}
+
+cem_tool::~cem_tool() {
+    std::fflush(stdout);
+    std::fflush(stderr);
+}
+
+
+
+void cem_tool::guess_mfx_name(fusion::cem_ext_manifest* ext_man, const std::filesystem::path& editor_mfx_path) {
+    std::regex mfx_name_regex(".*/(.*)\\.mfx");         // Get mfxname from editor .mfx
+    std::smatch match;
+
+    auto filepath = editor_mfx_path.string();
+
+    if(std::regex_search(filepath, match, mfx_name_regex)) {
+        ext_man->mfxname = match[1];
+    }
+}
+
+std::vector<std::filesystem::path> cem_tool::find_editor_mfxs(const path_table& zip_files) {
+    std::regex editor_mfx_regex("Extensions/(Unicode/|HWA/)?.*\\.mfx");
+    std::vector<std::string> editor_mfxs;
+
+    for (auto &&f : zip_files) {
+        if(std::regex_match(f.data(), f.data() + f.size(), editor_mfx_regex)) {
+            editor_mfxs.push_back(std::string(f));
+        }
+    }
+
+    if(editor_mfxs.empty()) {
+        throw std::runtime_error("No editor .mfx file? Bad file structure?");
+    }
+
+    sort_editor_mfxs(&editor_mfxs);
+    return {editor_mfxs.begin(), editor_mfxs.end()};
+}
+
+
+// Every variant is loaded in its own cem-tool process at the same time, so they cant
+// clash with each other (same dll names, global state) and a crash only loses one variant.
+fusion::ext_probe cem_tool::probe_editor_mfxs(const std::filesystem::path& base_directory, const std::vector<std::filesystem::path>& editor_mfxs) {
+    auto executable = probe_command.empty() ? current_executable_path() : probe_command;
+
+    std::vector<std::future<process_result>> running;
+    for (auto &&mfx : editor_mfxs) {
+        std::vector<std::string> probe_args = {"probe", std::filesystem::absolute(base_directory / mfx).string()};
+        if(run_infos) {
+            probe_args.insert(probe_args.begin() + 1, "--run-infos");
+        }
+        running.push_back(std::async(std::launch::async, run_process, executable, probe_args, std::chrono::milliseconds(probe_timeout)));
+    }
+
+    std::vector<std::optional<fusion::ext_probe>> probes;
+    for (size_t i = 0; i < editor_mfxs.size(); i++) {
+        bool timed_out = false;
+
+        try {
+            auto result = running[i].get();
+            timed_out = result.timed_out;
+
+            if(result.timed_out) {
+                throw create_except<std::runtime_error>("Probe was killed after %lld seconds.", (long long)probe_timeout.count());
+            }
+
+            if(result.exit_code != 0) {
+                throw create_except<std::runtime_error>("Probe exited with code %d.", result.exit_code);
+            }
+
+            probes.push_back(fusion::ext_probe::from_json(result.output));
+            metrics::add(metrics::counter::probe_successes);
+        }
+        catch(const std::exception& e) {
+            std::fprintf(stderr, "Failed to load '%s': %s\n", editor_mfxs[i].string().c_str(), e.what());
+            probes.push_back(std::nullopt);
+            metrics::add(timed_out ? metrics::counter::probe_timeouts : metrics::counter::probe_failures);
+        }
+    }
+
+    // First variant that loaded wins, others are only compared against it.
+    size_t preferred = editor_mfxs.size();
+    for (size_t i = 0; i < probes.size(); i++) {
+        if(!probes[i]) {
+            continue;
+        }
+
+        if(preferred == editor_mfxs.size()) {
+            preferred = i;
+            continue;
+        }
+
+        auto &&a = *probes[preferred];
+        auto &&b = *probes[i];
+
+        auto compare = [&](const char* field, const std::string& value_a, const std::string& value_b) {
+            if(value_a != value_b) {
+                std::fprintf(stderr, "Editor mfx variants dont match: %s is '%s' in '%s' but '%s' in '%s'.\n", field, value_a.c_str(), editor_mfxs[preferred].string().c_str(), value_b.c_str(), editor_mfxs[i].string().c_str());
+            }
+        };
+
+        compare("product", std::to_string(a.product), std::to_string(b.product));
+        compare("name", a.infos.name, b.infos.name);
+        compare("author", a.infos.author, b.infos.author);
+        compare("copyright", a.infos.copyright, b.infos.copyright);
+        compare("comment", a.infos.comment, b.infos.comment);
+        compare("website", a.infos.website, b.infos.website);
+
+        if(a.run_infos && b.run_infos) {
+            compare("identifier", std::to_string(a.run_infos->identifier), std::to_string(b.run_infos->identifier));
+            compare("condition count", std::to_string(a.run_infos->conditions), std::to_string(b.run_infos->conditions));
+            compare("action count", std::to_string(a.run_infos->actions), std::to_string(b.run_infos->actions));
+            compare("expression count", std::to_string(a.run_infos->expressions), std::to_string(b.run_infos->expressions));
+        }
+    }
+
+    if(preferred == editor_mfxs.size()) {
+        throw std::runtime_error("Failed to load any editor .mfx file.");
+    }
+
+    return *probes[preferred];
+}
@@ -1,10 +1,23 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <cstdint>
 
 #include "fusion_ext.hpp"
+#include "catalog.hpp"
+#include "ext_checker.hpp"
+#include "manifest_index.hpp"
+#include "output_writer.hpp"
+#include "pe_imports.hpp"
+#include "precompress.hpp"
+#include "zip_prefetch.hpp"
+#include "zip_archive.hpp"
 
 
 
@@ -17,21 +30,128 @@ public:
     int run();
 
 private:
-    const char* usage = "usage: cem-tool [options] [zip file]\n\n"
+    const char* usage = "usage: cem-tool [options] [zip files, http:// zip file urls, unpacked extension directories or directories with zip files]\n"
+                        "       cem-tool merge [options] [catalog files]\n"
+                        "       cem-tool index [options] [manifest or catalog files or directories with them]\n"
+                        "       cem-tool query [options] [terms]    (term: word, word*, name:, author:, description:, file:, platform:win)\n"
+                        "       cem-tool repack [options] [zip files]    (canonical entry order, fixed times, same compression)\n"
+                        "       cem-tool similar [options] [zip files or directories with zip files]    (groups of near identical zip files)\n"
+                        "       cem-tool imports [zip files, unpacked extension directories or mfx files]    (dlls editor mfx files need: bundled, system, mmfs2 or missing)\n"
+                        "       cem-tool probe [--run-infos] [editor mfx file]    (used internally, prints editor mfx infos as json)\n\n"
+                        "  --binary-catalog <file>\n"
+                        "                   Also write the catalog in compact binary format that can be memory mapped.\n"
+                        "                   Footprints and run infos are only in the json catalog.\n"
+                        "  --catalog <file> Write all manifests to one catalog file, in merge mode the merged catalog (default: catalog.json).\n"
+                        "  --delta <file>   Compare the catalog with a previous catalog and write changes to <catalog>.delta.json.\n"
+                        "  --footprint      Add compressed and extracted byte totals per platform and per zip section to manifests.\n"
+                        "  --gzip           Also write gzip compressed copies of manifests and catalogs (<file>.gz).\n"
                         "  --help           Display this message and exit.\n"
                         "  --ignore-errors  Ignore zip file structure check errors.\n"
+                        "  --index <file>   Index file used by index and query (default: manifests.idx), generate and watch runs\n"
+                        "                   add manifests (or the catalog) they write to it.\n"
+                        "  --jobs <n|min:max>\n"
+                        "                   Number of threads to use (default: number of cpu cores). With min:max batch runs process\n"
+                        "                   between min and max zip files at once, adjusted by measured throughput and printed on change.\n"
+                        "  --level <0-9>    Repack compression level (default: 9).\n"
+                        "  --metrics <file> Write counters and stage latencies in prometheus text format, updated while running,\n"
+                        "                   and a json summary to <file>.summary.json when done.\n"
+                        "  --no-probe       Dont load editor mfx files, name is the mfx name, author, description and website stay empty.\n"
+                        "  --output <file>  Repacked zip file (default: <zip name>-repacked.zip). With several zip files a directory\n"
+                        "                   (existing or ending with '/') that gets <zip name>-repacked.zip for each.\n"
+                        "  --output-dir <dir>\n"
+                        "                   Write manifests and default catalog and index files to dir instead of the current directory.\n"
+                        "  --probe-command <executable>\n"
+                        "                   Load editor mfx files with '<executable> probe <mfx file>' instead of cem-tool itself.\n"
+                        "  --run-infos      Add runtime object infos (identifier, version, edit flags, condition, action and expression counts) to manifests.\n"
+                        "  --threshold <0-1>\n"
+                        "                   How similar zip files have to be for similar (default: 0.8), share of same (path, size, crc) files.\n"
+                        "  --shard <i/N>    Only process zip files in shard i of N (1 <= i <= N), zip files are assigned by a hash of their name.\n"
+                        "  --watch <dir>    Keep running and write manifests for zip files created or modified in dir, remove them for deleted ones.\n"
                         "  --yes            Auto repond all prompts with yes.\n"
-                        "  --version        Show version info.\n"
+                        "  --zstd           Also write zstd compressed copies of manifests and catalogs (<file>.zst), if built with libzstd.\n"
+                        "  --version        Show version info.\n\n"
+                        "Manifests of unpacked extension directories have zipsize 0 and cant go into catalogs, generate them\n"
+                        "again from the zip file before publishing.\n"
                         "";
 
+    enum class command_type {
+        generate,       // Create manifests from zip files
+        merge,          // Merge partial catalogs
+        probe,          // Load one editor mfx and print its infos
+        index,          // Add manifests to the search index
+        query,          // Search the index
+        repack,         // Rewrite zip files in canonical form
+        imports,        // List dlls editor mfxs need
+        similar,        // Find near duplicate zip files
+    };
+
+    command_type command = command_type::generate;
     bool ignore_zip_sanity_check_errors = false;
     bool yes = false;
-    std::filesystem::path ext_zip_filepath;
+    std::uint64_t shard_index = 0;              // 0 based, --shard takes 1 based index.
+    std::uint64_t shard_count = 1;
+    std::vector<std::filesystem::path> input_filepaths;
+    std::vector<std::string> input_urls;        // http:// zip files
+    std::filesystem::path catalog_filepath;
+    std::filesystem::path binary_catalog_filepath;
+    std::filesystem::path index_filepath;
+    std::filesystem::path delta_base_filepath;
+    std::vector<std::string> query_terms;
+    std::filesystem::path output_filepath;
+    std::filesystem::path output_directory;     // Manifests and default catalog and index files, default current directory
+    std::filesystem::path watch_directory;
+    std::filesystem::path metrics_filepath;
+    std::filesystem::path probe_command;        // Empty = cem-tool itself
+    bool no_probe = false;
+    bool footprint = false;
+    bool run_infos = false;                     // Manifests get probe run infos
+    std::vector<precompress_format> precompress_formats;    // Compressed copies of written json files
+    int compress_level = 9;
+    double similar_threshold = 0.8;
+    unsigned jobs = 0;                          // 0 = std::thread::hardware_concurrency()
+    unsigned min_jobs = 0;                      // Batch runs process between min_jobs and jobs zip files at once, 0 = jobs
+    std::unique_ptr<output_writer> output;      // Everything written goes through it, see output_writer.hpp
+
+    void add_input(const std::string& arg);
+    bool is_extension_directory(const std::filesystem::path& directory);
+    bool in_shard(const std::filesystem::path& ext_zip_filepath);
+
+    int run_generate();
+    int run_merge();
+    int run_probe();
+    int run_index();
+    int run_query();
+    int run_repack();
+    int run_watch();
+    int run_imports();
+    int run_similar();
+
+    bool want_catalog();
+    void save_catalog(catalog& ext_catalog);
+    void load_index(manifest_index* index);
+    void update_index(manifest_index* index, const std::vector<std::filesystem::path>& sources);
+    bool remove_temp_directory();
+    std::filesystem::path write_manifest(const fusion::cem_ext_manifest& ext_man);
+    bool write_output(const std::filesystem::path& filepath, std::string_view data);
+    bool remove_output(const std::filesystem::path& filepath);
+
+    static constexpr unsigned prefetch_queue_depth = 64;    // Zip files with central directory read ahead
+    static constexpr std::chrono::milliseconds watch_debounce{250};    // Quiet time before changed zip files are processed
+    static constexpr std::chrono::milliseconds watch_max_wait{1000};   // Changed zip files are processed by then even if writes go on
+    static constexpr std::chrono::seconds probe_timeout{60};           // Editor mfx that doesnt load by then is killed
+    static constexpr std::chrono::seconds metrics_interval{10};        // How often --metrics file is rewritten
 
-    void zip_file_sanity_check(const std::string& ext_name, const std::vector<std::filesystem::path>& zip_files);
+    // Editor mfxs are extracted to temp_directory, one per worker.
+    fusion::cem_ext_manifest process_zip(const zip_central_directory& central_directory, const std::filesystem::path& temp_directory);
+    fusion::cem_ext_manifest process_url(const std::string& ext_zip_url, const std::filesystem::path& temp_directory);
+    fusion::cem_ext_manifest process_directory(const std::filesystem::path& ext_directory);
+    std::vector<std::filesystem::path> process_archive(fusion::cem_ext_manifest* ext_man, zip_archive* ext_zip, const std::string& ext_name, const std::filesystem::path& temp_directory, const std::function<void()>& open_entries);
+    std::vector<std::filesystem::path> finish_checks(fusion::cem_ext_manifest* ext_man, ext_checker* checker);
+    std::vector<std::vector<pe_import>> check_imports(std::vector<std::filesystem::path>* editor_mfxs, const path_table& files, const std::function<std::vector<std::uint8_t>(const std::string& path)>& read_file);
+    void probe_manifest(fusion::cem_ext_manifest* ext_man, const std::filesystem::path& base_directory, const std::vector<std::filesystem::path>& editor_mfxs);
 
     void guess_mfx_name(fusion::cem_ext_manifest* ext_man, const std::filesystem::path& editor_mfx_path);
-    void guess_supported_platforms(fusion::cem_ext_manifest* ext_man, const std::vector<std::filesystem::path>& zip_files);
 
-    std::filesystem::path find_editor_mfx(const std::vector<std::filesystem::path>& zip_files);
-};
\ No newline at end of file
+    std::vector<std::filesystem::path> find_editor_mfxs(const path_table& zip_files);
+    fusion::ext_probe probe_editor_mfxs(const std::filesystem::path& base_directory, const std::vector<std::filesystem::path>& editor_mfxs);
+};
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "concurrency_controller.hpp"
+
+
+
+
+concurrency_controller::concurrency_controller(unsigned min_workers, unsigned max_workers)
+    : min_workers(std::max(min_workers, 1u)), max_workers(std::max(max_workers, std::max(min_workers, 1u))) {
+    current_limit = this->min_workers;
+    start_window(std::chrono::steady_clock::now());
+}
+
+
+void concurrency_controller::observe_thread() {
+    if(min_workers != max_workers) {
+        metrics::stage_sums = stage_totals;
+    }
+}
+
+void concurrency_controller::acquire() {
+    std::unique_lock lock(mutex);
+    slot_free.wait(lock, [&]() {
+        return active < current_limit;
+    });
+    active++;
+}
+
+void concurrency_controller::release(bool completed) {
+    {
+        std::lock_guard lock(mutex);
+        active--;
+
+        if(completed) {
+            this->completed++;
+
+            auto now = std::chrono::steady_clock::now();
+            if(min_workers != max_workers && now - window_start >= window && this->completed >= current_limit) {
+                adjust(now);
+            }
+        }
+    }
+    slot_free.notify_all();
+}
+
+void concurrency_controller::add_input_wait(std::chrono::steady_clock::duration wait, size_t backlog) {
+    std::lock_guard lock(mutex);
+    input_wait += wait;
+    backlog_sum += backlog;
+    backlog_samples++;
+}
+
+unsigned concurrency_controller::limit() {
+    std::lock_guard lock(mutex);
+    return current_limit;
+}
+
+
+std::uint64_t concurrency_controller::stage_total(metrics::stage s) {
+    return stage_totals[(size_t)s].load(std::memory_order_relaxed);
+}
+
+std::uint64_t concurrency_controller::stage_sum(stage_group group) {
+    switch (group) {
+    case stage_group::listing:
+        return stage_total(metrics::stage::open) + stage_total(metrics::stage::list) + stage_total(metrics::stage::sanity_check);
+    case stage_group::inflating:
+        return stage_total(metrics::stage::extract);
+    case stage_group::probing:
+        return stage_total(metrics::stage::probe);
+    case stage_group::writing:
+        return stage_total(metrics::stage::write);
+    default:
+        return 0;
+    }
+}
+
+void concurrency_controller::start_window(std::chrono::steady_clock::time_point now) {
+    window_start = now;
+    completed = 0;
+    input_wait = std::chrono::steady_clock::duration::zero();
+    backlog_sum = 0;
+    backlog_samples = 0;
+
+    for (size_t i = 0; i < (size_t)stage_group::count; i++) {
+        stage_sums[i] = stage_sum((stage_group)i);
+    }
+}
+
+
+// Called with mutex held at the end of a window.
+void concurrency_controller::adjust(std::chrono::steady_clock::time_point now) {
+    double seconds = std::chrono::duration<double>(now - window_start).count();
+    double throughput = completed / seconds;
+    double change = last_throughput > 0 ? throughput / last_throughput - 1 : 0;
+    double wait_share = std::chrono::duration<double>(input_wait).count() / (seconds * current_limit);
+    double backlog = backlog_samples ? static_cast<double>(backlog_sum) / backlog_samples : 0;
+
+    double stage_shares[(size_t)stage_group::count];
+    double total = 0;
+    for (size_t i = 0; i < (size_t)stage_group::count; i++) {
+        stage_shares[i] = static_cast<double>(stage_sum((stage_group)i) - stage_sums[i]);
+        total += stage_shares[i];
+    }
+    for (auto &&share : stage_shares) {
+        share /= std::max(total, 1.0);
+    }
+
+    // Less than one input ready on average = workers take them as fast as storage delivers.
+    bool input_drained = backlog < 1;
+
+    const char* reason = nullptr;
+    unsigned next_limit = current_limit;
+
+    auto step = [&]() {
+        if(direction > 0) {
+            next_limit = slow_start ? current_limit * 2 : current_limit + 1;
+        } else {
+            next_limit = current_limit - std::min(current_limit, 1u);
+        }
+        next_limit = std::clamp(next_limit, min_workers, max_workers);
+    };
+
+    if(wait_share > starved_share && input_drained) {
+        // More workers only add more reads to storage that cant keep up.
+        reason = "workers mostly wait for input";
+        direction = -1;
+        slow_start = false;
+        step();
+    } else if(stage_shares[(size_t)stage_group::listing] > io_bound_share && input_drained && direction > 0) {
+        // Listing reads from storage too, with nothing read ahead more workers only add reads.
+        reason = "listing zip files takes most time";
+        direction = -1;
+        slow_start = false;
+        step();
+    } else if(last_throughput == 0) {
+        reason = "first measurement";
+        step();
+    } else if(change > significant_change) {
+        reason = "throughput improved";
+        step();
+    } else if(change < -significant_change) {
+        reason = "throughput dropped";
+        direction = -direction;
+        slow_start = false;
+        step();
+    }
+
+    if(next_limit != current_limit) {
+        std::printf("Jobs %u -> %u: %s, %.1f zip files/s (%+.0f%%), listing %.0f%% inflating %.0f%% probing %.0f%% writing %.0f%%, input wait %.0f%%, %.1f inputs ready.\n",
+            current_limit, next_limit, reason, throughput, change * 100,
+            stage_shares[0] * 100, stage_shares[1] * 100, stage_shares[2] * 100, stage_shares[3] * 100, wait_share * 100, backlog);
+
+        current_limit = next_limit;
+    }
+
+    last_throughput = throughput;
+    start_window(now);
+}
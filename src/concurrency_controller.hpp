@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "metrics.hpp"
+
+// How many zip files a batch run processes at the same time, between min and max.
+// Throughput (zip files per second), where time goes (listing, inflating, probing, writing, waiting
+// for input) and how many prefetched inputs are ready is measured over short windows from metrics stage
+// times, the limit climbs while throughput improves and backs off when it drops or when storage is the
+// bottleneck (workers wait for input or listing takes most time while nothing is read ahead).
+// Stage times are summed by the controller itself for threads that called observe_thread(), with or without metrics.
+// With min == max nothing is measured or printed.
+// Every change is printed with the numbers behind it.
+
+
+
+class concurrency_controller {
+public:
+    concurrency_controller(unsigned min_workers, unsigned max_workers);
+
+    // Stage times of the calling thread count for this controller, call once at start of each worker.
+    void observe_thread();
+
+    // Blocks until less than limit() workers are busy.
+    void acquire();
+
+    // Worker is done, completed = it processed a zip file (not out of input).
+    void release(bool completed);
+
+    // Time a worker spent waiting for its next input and how many inputs were already read ahead when it asked.
+    void add_input_wait(std::chrono::steady_clock::duration wait, size_t backlog);
+
+    unsigned limit();
+
+private:
+    // Stages that are measured, several metrics stages each.
+    enum class stage_group {
+        listing,        // open, list, sanity_check
+        inflating,      // extract
+        probing,        // probe
+        writing,        // write
+        count
+    };
+
+    static constexpr std::chrono::milliseconds window{1000};
+    static constexpr double significant_change = 0.05;     // Smaller throughput changes are noise
+    static constexpr double starved_share = 0.5;           // Input waits above this share of worker time = storage cant keep up
+    static constexpr double io_bound_share = 0.5;          // Listing above this share of stage time with empty backlog = storage cant keep up
+
+    unsigned min_workers;
+    unsigned max_workers;
+    unsigned current_limit;
+    unsigned active = 0;
+
+    std::mutex mutex;
+    std::condition_variable slot_free;
+
+    // Current window
+    std::chrono::steady_clock::time_point window_start;
+    std::uint64_t completed = 0;
+    std::chrono::steady_clock::duration input_wait{0};
+    std::uint64_t backlog_sum = 0;
+    std::uint64_t backlog_samples = 0;
+    std::uint64_t stage_sums[(size_t)stage_group::count] = {};     // Stage sums at window start, microseconds
+
+    std::atomic<std::uint64_t> stage_totals[(size_t)metrics::stage::count] = {};     // Added to by observed threads
+
+    // Hill climbing
+    double last_throughput = 0;
+    int direction = 1;
+    bool slow_start = true;         // Double until throughput stops improving, then one at a time
+
+    std::uint64_t stage_total(metrics::stage s);
+    std::uint64_t stage_sum(stage_group group);
+    void adjust(std::chrono::steady_clock::time_point now);
+    void start_window(std::chrono::steady_clock::time_point now);
+};
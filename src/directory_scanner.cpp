@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "directory_scanner.hpp"
+
+
+
+struct scanned_file {
+    std::string path;
+    zip_file_stat stat;
+};
+
+
+static std::time_t to_time_t(std::filesystem::file_time_type time) {
+    return std::chrono::system_clock::to_time_t(std::chrono::file_clock::to_sys(std::chrono::time_point_cast<std::chrono::file_clock::duration>(time)));
+}
+
+path_table scan_directory(const std::filesystem::path& root, std::vector<zip_file_stat>* stats, unsigned jobs) {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::filesystem::path> pending = {root};
+    size_t busy = 0;                            // Directories being read, more can come from them
+    std::exception_ptr error;
+    std::vector<scanned_file> files;
+
+    auto worker = [&]() {
+        std::unique_lock lock(mutex);
+
+        while(true) {
+            condition.wait(lock, [&]() { return !pending.empty() || busy == 0 || error; });
+
+            if(pending.empty() || error) {
+                return;
+            }
+
+            auto directory = std::move(pending.back());
+            pending.pop_back();
+            busy++;
+            lock.unlock();
+
+            std::vector<std::filesystem::path> found_directories;
+            std::vector<scanned_file> found_files;
+            std::exception_ptr found_error;
+
+            try {
+                for (auto &&e : std::filesystem::directory_iterator(directory)) {
+                    // Symlinked directories could loop.
+                    if(e.is_directory() && !e.is_symlink()) {
+                        found_directories.push_back(e.path());
+                    } else if(e.is_regular_file()) {
+                        auto size = static_cast<std::int64_t>(e.file_size());
+                        found_files.push_back({e.path().lexically_relative(root).generic_string(), {to_time_t(e.last_write_time()), size, size, 0}});
+                    }
+                }
+            }
+            catch(...) {
+                found_error = std::current_exception();
+            }
+
+            lock.lock();
+            busy--;
+
+            if(found_error && !error) {
+                error = found_error;
+            }
+
+            pending.insert(pending.end(), std::make_move_iterator(found_directories.begin()), std::make_move_iterator(found_directories.end()));
+            files.insert(files.end(), std::make_move_iterator(found_files.begin()), std::make_move_iterator(found_files.end()));
+            condition.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < std::max(jobs, 1u); i++) {
+        threads.emplace_back(worker);
+    }
+
+    for (auto &&t : threads) {
+        t.join();
+    }
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+
+    // Threads finish in any order.
+    std::sort(files.begin(), files.end(), [](const scanned_file& a, const scanned_file& b) {
+        return a.path < b.path;
+    });
+
+    path_table ret;
+    for (auto &&f : files) {
+        ret.push_back(f.path);
+
+        if(stats) {
+            stats->push_back(f.stat);
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "path_table.hpp"
+#include "zip_archive.hpp"
+
+// Lists unpacked extension directories like zip_archive lists zip files.
+
+
+
+// All files under root, paths relative to root with '/' separators, sorted.
+// Directories are read by up to jobs threads at once, stats get file size as both compressed and uncompressed size and no crc (0).
+path_table scan_directory(const std::filesystem::path& root, std::vector<zip_file_stat>* stats, unsigned jobs);
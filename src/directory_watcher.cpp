@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <map>
+
+#include "directory_watcher.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+
+
+#ifdef _WIN32
+static std::uintmax_t file_size_or_max(const std::filesystem::path& file_path) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(file_path, ec);
+    return ec ? UINTMAX_MAX : size;
+}
+
+// Opening without write sharing fails while whoever writes the file still has it open.
+// Files that cant be opened for other reasons are reported, processing them reports the error.
+static bool finished_writing(const std::filesystem::path& file_path, std::uintmax_t last_size, std::uintmax_t* size) {
+    HANDLE file = CreateFileW(file_path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        *size = file_size_or_max(file_path);
+        return GetLastError() != ERROR_SHARING_VIOLATION;
+    }
+
+    LARGE_INTEGER file_size = {};
+    bool ok = GetFileSizeEx(file, &file_size);
+    CloseHandle(file);
+
+    *size = ok ? static_cast<std::uintmax_t>(file_size.QuadPart) : UINTMAX_MAX;
+    return !ok || *size == last_size;
+}
+
+directory_watcher::directory_watcher(const std::filesystem::path& directory) : directory(directory) {
+    rescan(nullptr);
+
+    directory_handle = CreateFileW(directory.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+
+    if(directory_handle == INVALID_HANDLE_VALUE) {
+        directory_handle = nullptr;
+        throw create_except<std::runtime_error>("Failed to watch '%s': %s.", directory.string().c_str(), last_system_error().c_str());
+    }
+
+    event_handle = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+}
+
+directory_watcher::~directory_watcher() {
+    if(directory_handle) {
+        CancelIo(directory_handle);
+        CloseHandle(directory_handle);
+    }
+    if(event_handle) {
+        CloseHandle(event_handle);
+    }
+}
+
+std::vector<directory_watcher_event> directory_watcher::wait(std::chrono::milliseconds debounce, std::chrono::milliseconds max_wait) {
+    std::map<std::filesystem::path, bool> changes;
+    std::map<std::filesystem::path, std::uintmax_t> sizes;     // At last event, to see if files still grow
+    bool overflowed = false;
+    DWORD timeout = INFINITE;
+    std::chrono::steady_clock::time_point deadline;
+
+    // Held back files are checked again after debounce even if nothing else happens.
+    if(!unfinished.empty()) {
+        for (auto &&[file_path, size] : unfinished) {
+            changes[file_path] = false;
+        }
+        sizes = std::move(unfinished);
+        unfinished.clear();
+
+        timeout = static_cast<DWORD>(debounce.count());
+        deadline = std::chrono::steady_clock::now() + max_wait;
+    }
+
+    while(true) {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = event_handle;
+        ResetEvent(event_handle);
+
+        DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+        if(!ReadDirectoryChangesW(directory_handle, buffer, sizeof(buffer), FALSE, filter, nullptr, &overlapped, nullptr)) {
+            throw create_except<std::runtime_error>("Failed to watch '%s': %s.", directory.string().c_str(), last_system_error().c_str());
+        }
+
+        if(WaitForSingleObject(event_handle, timeout) == WAIT_TIMEOUT) {
+            CancelIo(directory_handle);
+            GetOverlappedResult(directory_handle, &overlapped, nullptr, TRUE);
+            break;
+        }
+
+        DWORD size = 0;
+        if(!GetOverlappedResult(directory_handle, &overlapped, &size, FALSE)) {
+            if(GetLastError() != ERROR_NOTIFY_ENUM_DIR) {
+                throw create_except<std::runtime_error>("Failed to watch '%s': %s.", directory.string().c_str(), last_system_error().c_str());
+            }
+            size = 0;
+        }
+
+        // size 0 = buffer overflowed, changes are lost but next events still come.
+        if(!size) {
+            overflowed = true;
+        }
+
+        for (DWORD offset = 0; size; ) {
+            auto info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(buffer + offset);
+            auto file_path = directory / std::wstring(info->FileName, info->FileNameLength / sizeof(wchar_t));
+
+            bool removed = info->Action == FILE_ACTION_REMOVED || info->Action == FILE_ACTION_RENAMED_OLD_NAME;
+            changes[file_path] = removed;
+            if(!removed) {
+                sizes[file_path] = file_size_or_max(file_path);
+            }
+
+            if(!info->NextEntryOffset) {
+                break;
+            }
+            offset += info->NextEntryOffset;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(timeout == INFINITE) {
+            deadline = now + max_wait;
+        }
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        if(left.count() <= 0) {
+            break;
+        }
+        timeout = static_cast<DWORD>(std::min(debounce, left).count());
+    }
+
+    auto events = finish(changes, overflowed);
+
+    // Unlike close write on linux, changes come while files are written.
+    std::erase_if(events, [&](const directory_watcher_event& e) {
+        if(e.removed) {
+            return false;
+        }
+
+        auto it = sizes.find(e.file_path);
+        std::uintmax_t size;
+        if(finished_writing(e.file_path, it != sizes.end() ? it->second : UINTMAX_MAX, &size)) {
+            return false;
+        }
+
+        unfinished[e.file_path] = size;
+        return true;
+    });
+
+    return events;
+}
+#else
+directory_watcher::directory_watcher(const std::filesystem::path& directory) : directory(directory) {
+    rescan(nullptr);
+
+    fd = inotify_init1(IN_CLOEXEC);
+
+    // Close write instead of modify so half written files are not reported.
+    if(fd < 0 || inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+        auto error = last_system_error();
+        if(fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        throw create_except<std::runtime_error>("Failed to watch '%s': %s.", directory.string().c_str(), error.c_str());
+    }
+}
+
+directory_watcher::~directory_watcher() {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+std::vector<directory_watcher_event> directory_watcher::wait(std::chrono::milliseconds debounce, std::chrono::milliseconds max_wait) {
+    std::map<std::filesystem::path, bool> changes;
+    bool overflowed = false;
+    int timeout = -1;
+    std::chrono::steady_clock::time_point deadline;
+
+    while(true) {
+        pollfd poll_fd = {fd, POLLIN, 0};
+        int status = poll(&poll_fd, 1, timeout);
+
+        if(status < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw create_except<std::runtime_error>("Failed to watch '%s': %s.", directory.string().c_str(), last_system_error().c_str());
+        }
+
+        if(status == 0) {
+            break;
+        }
+
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        if(size < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw create_except<std::runtime_error>("Failed to watch '%s': %s.", directory.string().c_str(), last_system_error().c_str());
+        }
+
+        for (ssize_t offset = 0; offset < size; ) {
+            auto event = reinterpret_cast<const inotify_event*>(buffer + offset);
+
+            // Queue overflow has no name, events were dropped.
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+            } else if(event->len) {
+                changes[directory / event->name] = event->mask & (IN_MOVED_FROM | IN_DELETE);
+            }
+
+            offset += sizeof(inotify_event) + event->len;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(timeout < 0) {
+            deadline = now + max_wait;
+        }
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        if(left.count() <= 0) {
+            break;
+        }
+        timeout = static_cast<int>(std::min(debounce, left).count());
+    }
+
+    return finish(changes, overflowed);
+}
+#endif
+
+
+bool directory_watcher::get_file_state(const std::filesystem::path& file_path, file_state* state) {
+    std::error_code ec;
+    if(!std::filesystem::is_regular_file(file_path, ec)) {
+        return false;
+    }
+
+    state->size = std::filesystem::file_size(file_path, ec);
+    state->modified = std::filesystem::last_write_time(file_path, ec);
+    return !ec;
+}
+
+// Compares the directory with the last known state, changes = nullptr only records it.
+void directory_watcher::rescan(std::map<std::filesystem::path, bool>* changes) {
+    std::map<std::filesystem::path, file_state> current;
+    std::error_code ec;
+
+    for (auto &&e : std::filesystem::directory_iterator(directory, ec)) {
+        file_state state;
+        if(get_file_state(e.path(), &state)) {
+            current[e.path()] = state;
+        }
+    }
+
+    if(ec) {
+        throw create_except<std::runtime_error>("Failed to scan '%s': %s.", directory.string().c_str(), ec.message().c_str());
+    }
+
+    if(changes) {
+        for (auto &&[file_path, state] : current) {
+            auto it = files.find(file_path);
+            if(it == files.end() || it->second.size != state.size || it->second.modified != state.modified) {
+                (*changes)[file_path] = false;
+            }
+        }
+
+        for (auto &&[file_path, state] : files) {
+            if(!current.contains(file_path)) {
+                (*changes)[file_path] = true;
+            }
+        }
+    }
+
+    files = std::move(current);
+}
+
+std::vector<directory_watcher_event> directory_watcher::finish(std::map<std::filesystem::path, bool>& changes, bool overflowed) {
+    if(overflowed) {
+        rescan(&changes);
+    }
+
+    std::vector<directory_watcher_event> ret;
+    for (auto &&[file_path, removed] : changes) {
+        file_state state;
+        if(!removed && get_file_state(file_path, &state)) {
+            files[file_path] = state;
+        } else {
+            files.erase(file_path);
+        }
+
+        ret.push_back({file_path, removed});
+    }
+    return ret;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include <cstdint>
+
+// Reports files created, modified or removed in one directory (not recursive).
+// inotify on linux, ReadDirectoryChangesW on windows.
+// If the system drops events (queue or buffer overflow) the directory is rescanned and compared with
+// the size and modification time of files seen before, so nothing is lost.
+// Windows reports writes while a file is still being written, files still open for writing or that grew
+// since their last event are held back and checked again on the next wait().
+
+
+
+struct directory_watcher_event {
+    std::filesystem::path file_path;
+    bool removed;                           // Otherwise created or modified
+};
+
+
+class directory_watcher {
+public:
+    directory_watcher(const std::filesystem::path& directory);
+    directory_watcher(const directory_watcher&) = delete;
+    directory_watcher& operator=(const directory_watcher&) = delete;
+    ~directory_watcher();
+
+    // Blocks until something changes and then until nothing changed for debounce time, but at most
+    // max_wait after the first change so a directory that keeps getting writes is still processed.
+    // Every file is reported once with its last state.
+    std::vector<directory_watcher_event> wait(std::chrono::milliseconds debounce, std::chrono::milliseconds max_wait);
+
+private:
+    struct file_state {
+        std::uintmax_t size;
+        std::filesystem::file_time_type modified;
+    };
+
+    std::filesystem::path directory;
+    std::map<std::filesystem::path, file_state> files;     // Last known state, compared on rescan
+    std::map<std::filesystem::path, std::uintmax_t> unfinished;    // Windows: held back files and their size then
+
+    static bool get_file_state(const std::filesystem::path& file_path, file_state* state);
+    void rescan(std::map<std::filesystem::path, bool>* changes);
+    std::vector<directory_watcher_event> finish(std::map<std::filesystem::path, bool>& changes, bool overflowed);
+
+    // inotify fd or directory HANDLE + OVERLAPPED event
+    int fd = -1;
+    void* directory_handle = nullptr;
+    void* event_handle = nullptr;
+    alignas(8) unsigned char buffer[64 * 1024];
+};
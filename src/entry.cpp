@@ -7,6 +7,7 @@
 
 
 
+#ifdef _WIN32
 int wmain(int argc, const wchar_t* argv[]) {
     windows_utf8_in_console utf8;   // unicode madness
 
@@ -19,3 +20,12 @@ int wmain(int argc, const wchar_t* argv[]) {
     cem_tool app(args);
     return app.run();
 }
+#else
+// Arguments are already utf8.
+int main(int argc, const char* argv[]) {
+    std::vector<std::string> args(argv, argv + argc);
+
+    cem_tool app(args);
+    return app.run();
+}
+#endif
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "ext_checker.hpp"
+#include "string_helper.hpp"
+
+
+
+
+ext_checker::ext_checker(const std::string& ext_name, bool ignore_errors, bool footprint)
+    : ext_name(ext_name), ignore_errors(ignore_errors), with_footprint(footprint) {
+    // Test all extension runtime and editor files if they have consistent names.
+    // Not realy possible to combine those because capture groups get messed up.
+    const char* name_test_patterns[] = {
+        "Extensions/(?:Unicode/|HWA/)?(.*)\\.mfx",
+        "Data/Runtime/(?:Unicode/|HWA/)?(.*)\\.mfx",
+        "Data/Runtime/Flash/(.*)\\.zip",
+        "Data/Runtime/Android/(.*)\\.zip",
+        "Data/Runtime/iPhone/(.*)\\.ext",
+        "Data/Runtime/Html5/(.*)\\.js",
+        "Data/Runtime/Wua/js/runtime/extensions/source/(.*)\\.js",
+        "Data/Runtime/Mac/(.*)\\.dat",
+        "Data/Runtime/XNA/(?:Phone|Windows|Xbox)/(.*)\\.zip",
+    };
+
+    for (auto &&p : name_test_patterns) {
+        name_tests.emplace_back(p);
+    }
+
+    // All directories must be matched by that massive regex.
+    directory_regex = std::regex("Extensions/(Unicode/|HWA/)?|Data/Runtime/((Unicode/|HWA/)?|Flash/|Android/|iPhone/|Html5/|Wua/js/runtime/extensions/source/|Mac/|XNA/(Phone|Windows|Xbox)/)|Examples/(.*)?|Help/(.*)?");
+    editor_mfx_regex = std::regex("Extensions/(Unicode/|HWA/)?.*\\.mfx");
+    runtime_mfx_regex = std::regex("Data/Runtime/((Unicode/|HWA/)?.*\\.mfx|Flash/.*\\.zip|Android/.*\\.zip|iPhone/.*\\.ext|Html5/.*\\.js|Wua/js/runtime/extensions/source/.*\\.js|Mac/.*\\.dat|XNA/(Phone|Windows|Xbox)/.*\\.zip)");
+
+    // Matches fusion::platform enum
+    const char* platform_patterns[] = {
+        "Data/Runtime/(Unicode/|HWA/)?.*\\.mfx",
+        "Data/Runtime/Flash/.*\\.zip",
+        "Data/Runtime/Android/.*\\.zip",
+        "Data/Runtime/iPhone/.*\\.ext",
+        "Data/Runtime/Html5/.*\\.js",
+        "Data/Runtime/Wua/js/runtime/extensions/source/.*\\.js",
+        "Data/Runtime/Mac/.*\\.dat",
+        "Data/Runtime/XNA/(Phone|Windows|Xbox)/.*\\.zip",
+    };
+
+    for (auto &&p : platform_patterns) {
+        platform_tests.emplace_back(p);
+    }
+}
+
+
+void ext_checker::structure_error(const std::runtime_error& e) {
+    if(!ignore_errors) {
+        throw e;
+    }
+
+    // Checks stop at first error, same as when they ran over the whole list.
+    std::fprintf(stderr, "(ignored) %s\n", e.what());
+    structure_failed = true;
+}
+
+
+void ext_checker::add(std::string_view filepath, const zip_file_stat& stat) {
+    auto begin = filepath.data();
+    auto end = filepath.data() + filepath.size();
+
+    if(!structure_failed) {
+        std::cmatch match;
+
+        for (auto &&t : name_tests) {
+            if(std::regex_search(begin, end, match, t) && match[1] != ext_name) {
+                structure_error(create_except("Bad zip file structure: File '%s' is named '%s' but expected '%s'.", std::string(filepath).c_str(), match[1].str().c_str(), ext_name.c_str()));
+                break;
+            }
+        }
+    }
+
+    auto directory = filepath.substr(0, filepath.rfind('/') + 1);     // npos + 1 = 0, no directory
+    // Zip listings are mostly grouped by directory.
+    if(!structure_failed && directory != last_directory) {
+        last_directory = directory;
+
+        if(checked_directories.insert(last_directory).second && !std::regex_match(directory.begin(), directory.end(), directory_regex)) {
+            structure_error(create_except("Bad zip file structure: Directory '%s' was not recognized, typo?", last_directory.c_str()));
+        }
+    }
+
+    if(std::regex_match(begin, end, editor_mfx_regex)) {
+        editor_mfxs.emplace_back(filepath);
+    }
+
+    if(!has_runtime_file && std::regex_match(begin, end, runtime_mfx_regex)) {
+        has_runtime_file = true;
+    }
+
+    for (size_t i = 0; i < platform_tests.size(); i++) {
+        auto platform = fusion::platform_index_to_enum(i);
+        if(!(platforms & platform) && std::regex_match(begin, end, platform_tests[i])) {
+            platforms |= platform;
+        }
+    }
+
+    // Latest modified date
+    if(time < stat.modified_date) {
+        time = stat.modified_date;
+    }
+
+    if(with_footprint) {
+        add_footprint(filepath, stat);
+    }
+}
+
+
+// Sizes straight from the central directory, nothing is extracted.
+// Platform of a runtime file is its Data/Runtime directory, so libraries next to the runtime mfx count too.
+void ext_checker::add_footprint(std::string_view filepath, const zip_file_stat& stat) {
+    // Matches fusion::platform enum, windows is everything else in Data/Runtime/
+    const char* platform_directories[] = {
+        "Data/Runtime/",
+        "Data/Runtime/Flash/",
+        "Data/Runtime/Android/",
+        "Data/Runtime/iPhone/",
+        "Data/Runtime/Html5/",
+        "Data/Runtime/Wua/",
+        "Data/Runtime/Mac/",
+        "Data/Runtime/XNA/",
+    };
+
+    auto add = [&](fusion::footprint_size* size) {
+        size->compressed += stat.compressed_size;
+        size->uncompressed += stat.uncompressed_size;
+    };
+
+    if(filepath.starts_with("Extensions/")) {
+        add(&footprint.extensions);
+    } else if(filepath.starts_with("Data/")) {
+        add(&footprint.runtime);
+    } else if(filepath.starts_with("Help/")) {
+        add(&footprint.help);
+    } else if(filepath.starts_with("Examples/")) {
+        add(&footprint.examples);
+    } else {
+        add(&footprint.other);
+    }
+
+    if(!filepath.starts_with(platform_directories[0])) {
+        return;
+    }
+
+    size_t platform = 0;
+    for (size_t i = 1; i < std::size(platform_directories); i++) {
+        if(filepath.starts_with(platform_directories[i])) {
+            platform = i;
+            break;
+        }
+    }
+
+    add(&footprint.platforms[platform]);
+}
+
+
+std::vector<std::filesystem::path> ext_checker::finish(fusion::cem_ext_manifest* ext_man) {
+    // Check if any editor .mfx is present in Extensions/
+    if(!structure_failed && editor_mfxs.empty()) {
+        structure_error(std::runtime_error("Bad zip file structure: The zip file doesnt contain any editor .mfx file."));
+    }
+
+    // Check if at least one runtime extension file is present in Data/Runtime/
+    if(!structure_failed && !has_runtime_file) {
+        structure_error(std::runtime_error("Bad zip file structure: The zip file doesnt contain any runtime extension file."));
+    }
+
+    if(editor_mfxs.empty()) {
+        throw std::runtime_error("No editor .mfx file? Bad file structure?");
+    }
+
+    if(!platforms) {
+        throw std::runtime_error("No platforms supported? Bad file structure?");
+    }
+
+    ext_man->platforms = platforms;
+
+    // Seems like original tool adds one second
+    ext_man->time = time + 1;
+
+    if(with_footprint) {
+        ext_man->footprint = footprint;
+    }
+
+    sort_editor_mfxs(&editor_mfxs);
+    return {editor_mfxs.begin(), editor_mfxs.end()};
+}
+
+
+
+static int editor_mfx_rank(const std::string& filepath) {
+    if(filepath.starts_with("Extensions/Unicode/")) {
+        return 0;
+    }
+
+    if(filepath.starts_with("Extensions/HWA/")) {
+        return 2;
+    }
+
+    return 1;
+}
+
+// Dont depend on zip central directory order.
+void sort_editor_mfxs(std::vector<std::string>* editor_mfxs) {
+    std::sort(editor_mfxs->begin(), editor_mfxs->end(), [](const std::string& a, const std::string& b) {
+        int rank_a = editor_mfx_rank(a);
+        int rank_b = editor_mfx_rank(b);
+        return rank_a != rank_b ? rank_a < rank_b : a < b;
+    });
+}
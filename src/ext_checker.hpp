@@ -0,0 +1,63 @@
+#pragma once
+
+#include <filesystem>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+#include "fusion_ext.hpp"
+#include "path_table.hpp"
+#include "zip_archive.hpp"
+
+// Extension zip file structure checks done one file at a time, so listing, checking and
+// everything guessed from file paths is one pass and nothing depends on all files being kept.
+
+
+
+class ext_checker {
+public:
+    // Structure errors are thrown from add() and finish(), or printed once and ignored.
+    ext_checker(const std::string& ext_name, bool ignore_errors, bool footprint);
+
+    // Check the zip file structure, make sure:
+    // - Ext file names are the same
+    // - Directory structure is correct
+    // Also notes editor mfxs, platforms, latest modified date and footprint.
+    void add(std::string_view filepath, const zip_file_stat& stat);
+
+    // Make sure required ext files were present and fill platforms, time and footprint.
+    // Returns editor mfxs, preferred one first.
+    std::vector<std::filesystem::path> finish(fusion::cem_ext_manifest* ext_man);
+
+private:
+    std::string ext_name;
+    bool ignore_errors;
+    bool structure_failed = false;              // Only first ignored error is printed, like before
+
+    std::vector<std::regex> name_tests;
+    std::regex directory_regex;
+    std::regex editor_mfx_regex;
+    std::regex runtime_mfx_regex;
+    std::vector<std::regex> platform_tests;
+
+    std::unordered_set<std::string> checked_directories;   // Once per directory, not per file
+    std::string last_directory;
+    std::vector<std::string> editor_mfxs;
+    bool has_runtime_file = false;
+    std::uint32_t platforms = 0;
+    std::time_t time = 0;
+    bool with_footprint;
+    fusion::ext_footprint footprint = {};
+
+    void structure_error(const std::runtime_error& e);
+    void add_footprint(std::string_view filepath, const zip_file_stat& stat);
+};
+
+
+// Unicode variant first, its what current fusion versions load, HWA last, then by name.
+void sort_editor_mfxs(std::vector<std::string>* editor_mfxs);
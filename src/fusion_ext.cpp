@@ -1,13 +1,19 @@
+#include <algorithm>
 #include <cstdint>
 #include <filesystem>
+#include <cstdio>
+#include <ctime>
+#include <sstream>
 #include "fusion_ext.hpp"
 #include "string_helper.hpp"
 
 #include "nlohmann/json.hpp"
 
+#ifdef _WIN32
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#endif
 
 
 
@@ -36,8 +42,8 @@ static std::string yes_no(bool b) {
     return "no";
 }
 
-static nlohmann::json files_array(fusion::cem_ext_manifest* ext) {
-    nlohmann::json files;
+static nlohmann::json files_array(const fusion::cem_ext_manifest* ext) {
+    nlohmann::json files = nlohmann::json::array();
 
     for (auto&& i : ext->files) {
         files.push_back(i);
@@ -46,7 +52,7 @@ static nlohmann::json files_array(fusion::cem_ext_manifest* ext) {
     return files;
 }
 
-static std::string supported_platforms(fusion::cem_ext_manifest* ext) {
+static std::string supported_platforms(const fusion::cem_ext_manifest* ext) {
     uint32_t p = ext->platforms;
 
     std::string ret = "";
@@ -66,11 +72,15 @@ static std::string supported_platforms(fusion::cem_ext_manifest* ext) {
     return ret;
 }
 
-static std::string last_modification_time(fusion::cem_ext_manifest* ext) {
+static std::string last_modification_time(const fusion::cem_ext_manifest* ext) {
     char buf[sizeof("YYYY.MM.DD:HH.MM.SS")];
 
     tm formated_time;
+#ifdef _WIN32
     gmtime_s(&formated_time, &ext->time);
+#else
+    gmtime_r(&ext->time, &formated_time);
+#endif
 
     // This is off by one second for some reason, should creation date be checked as well?
     std::strftime(buf, sizeof(buf), "%Y.%m.%d:%H.%M.%S", &formated_time);
@@ -79,29 +89,260 @@ static std::string last_modification_time(fusion::cem_ext_manifest* ext) {
 }
 
 
-std::string fusion::cem_ext_manifest::to_json() {
+// Reverse of supported_platforms()
+static std::uint32_t parse_supported_platforms(const std::string& platforms) {
+    std::uint32_t ret = 0;
+
+    size_t begin = 0;
+    while(begin < platforms.size()) {
+        size_t end = platforms.find(',', begin);
+        if(end == std::string::npos) {
+            end = platforms.size();
+        }
+
+        auto name = platforms.substr(begin, end - begin);
+        bool found = false;
+
+        for (std::uint32_t i = 0; i < std::size(fusion::platform_names); i++) {
+            if(name == fusion::platform_names[i]) {
+                ret |= fusion::platform_index_to_enum(i);
+                found = true;
+                break;
+            }
+        }
+
+        if(!found) {
+            throw create_except<std::runtime_error>("Unknown platform '%s'.", name.c_str());
+        }
+
+        begin = end + 1;
+    }
+
+    return ret;
+}
+
+// Reverse of last_modification_time()
+static time_t parse_last_modification_time(const std::string& time) {
+    tm formated_time = {};
+
+    if(std::sscanf(time.c_str(), "%d.%d.%d:%d.%d.%d", &formated_time.tm_year, &formated_time.tm_mon, &formated_time.tm_mday, &formated_time.tm_hour, &formated_time.tm_min, &formated_time.tm_sec) != 6) {
+        throw create_except<std::runtime_error>("Bad time format '%s'.", time.c_str());
+    }
+
+    formated_time.tm_year -= 1900;
+    formated_time.tm_mon -= 1;
+
+#ifdef _WIN32
+    return _mkgmtime(&formated_time);
+#else
+    return timegm(&formated_time);
+#endif
+}
+
+
+static nlohmann::ordered_json footprint_size_object(const fusion::footprint_size& size) {
+    return {
+        {"compressed", size.compressed},
+        {"uncompressed", size.uncompressed},
+    };
+}
+
+static fusion::footprint_size parse_footprint_size(const nlohmann::ordered_json& j) {
+    return {j.at("compressed").get<std::uint64_t>(), j.at("uncompressed").get<std::uint64_t>()};
+}
+
+// Platforms without any files are left out.
+static nlohmann::ordered_json footprint_object(const fusion::cem_ext_manifest* ext) {
+    auto &&footprint = *ext->footprint;
+    nlohmann::ordered_json platforms = nlohmann::ordered_json::object();
+
+    for (std::uint32_t i = 0; i < std::size(footprint.platforms); i++) {
+        if(footprint.platforms[i].compressed || footprint.platforms[i].uncompressed || (ext->platforms & fusion::platform_index_to_enum(i))) {
+            platforms[fusion::platform_names[i]] = footprint_size_object(footprint.platforms[i]);
+        }
+    }
+
+    return {
+        {"platforms", platforms},
+        {"sections", {
+            {"extensions", footprint_size_object(footprint.extensions)},
+            {"runtime", footprint_size_object(footprint.runtime)},
+            {"help", footprint_size_object(footprint.help)},
+            {"examples", footprint_size_object(footprint.examples)},
+            {"other", footprint_size_object(footprint.other)},
+        }},
+    };
+}
+
+// Reverse of footprint_object()
+static fusion::ext_footprint parse_footprint(const nlohmann::ordered_json& j) {
+    fusion::ext_footprint ret = {};
+
+    for (auto &&[name, size] : j.at("platforms").items()) {
+        auto index = fusion::platform_enum_to_index(static_cast<fusion::platform>(parse_supported_platforms(name)));
+        ret.platforms[index] = parse_footprint_size(size);
+    }
+
+    auto &&sections = j.at("sections");
+    ret.extensions = parse_footprint_size(sections.at("extensions"));
+    ret.runtime = parse_footprint_size(sections.at("runtime"));
+    ret.help = parse_footprint_size(sections.at("help"));
+    ret.examples = parse_footprint_size(sections.at("examples"));
+    ret.other = parse_footprint_size(sections.at("other"));
+
+    return ret;
+}
+
+
+static nlohmann::ordered_json run_infos_object(const fusion::ext_run_summary& run_infos) {
+    return {
+        {"identifier", run_infos.identifier},
+        {"version", run_infos.version},
+        {"edit_flags", run_infos.edit_flags},
+        {"conditions", run_infos.conditions},
+        {"actions", run_infos.actions},
+        {"expressions", run_infos.expressions},
+    };
+}
+
+// Reverse of run_infos_object()
+static fusion::ext_run_summary parse_run_infos(const nlohmann::ordered_json& j) {
+    return {
+        j.at("identifier").get<std::uint32_t>(),
+        j.at("version").get<std::int32_t>(),
+        j.at("edit_flags").get<std::uint32_t>(),
+        j.at("conditions").get<std::uint32_t>(),
+        j.at("actions").get<std::uint32_t>(),
+        j.at("expressions").get<std::uint32_t>(),
+    };
+}
+
+
+// Files are passed in so to_json() can leave them out.
+static nlohmann::ordered_json manifest_object(const fusion::cem_ext_manifest* ext, nlohmann::json files) {
     nlohmann::ordered_json j = {
-        {"mfxname", mfxname},
-        {"name", name},
-        {"author", author},
-        {"description", description},
-        {"website", website},
-        {"dev", yes_no(dev)},
-        {"platforms", supported_platforms(this)},
-        {"time", last_modification_time(this)},
-        {"download", download},
-        {"zipsize", std::to_string(zipsize)},
-        {"files", files_array(this)}
+        {"mfxname", ext->mfxname},
+        {"name", ext->name},
+        {"author", ext->author},
+        {"description", ext->description},
+        {"website", ext->website},
+        {"dev", yes_no(ext->dev)},
+        {"platforms", supported_platforms(ext)},
+        {"time", last_modification_time(ext)},
+        {"download", ext->download},
+        {"zipsize", std::to_string(ext->zipsize)},
+        {"files", std::move(files)}
     };
 
-    return j.dump(1, '\t');     // tabs indent
+    if(ext->footprint) {
+        j["footprint"] = footprint_object(ext);
+    }
+
+    if(ext->run_infos) {
+        j["run_infos"] = run_infos_object(*ext->run_infos);
+    }
+
+    return j;
+}
+
+nlohmann::ordered_json fusion::cem_ext_manifest::to_json_object() const {
+    return manifest_object(this, files_array(this));
+}
+
+// Same output as to_json_object().dump(1, '\t'), tabs indent.
+std::string fusion::cem_ext_manifest::to_json() const {
+    auto j = manifest_object(this, nullptr);
+    std::ostringstream out;
+    bool first = true;
+
+    out << "{";
+    for (auto &&[key, value] : j.items()) {
+        out << (first ? "\n\t" : ",\n\t") << nlohmann::json(key).dump() << ": ";
+        first = false;
+
+        if(key != "files") {
+            // One level deeper than dump() thinks, strings cant contain raw new lines.
+            for (auto &&c : value.dump(1, '\t')) {
+                out << c;
+                if(c == '\n') {
+                    out << '\t';
+                }
+            }
+            continue;
+        }
+
+        if(files.empty()) {
+            out << "[]";
+            continue;
+        }
+
+        out << "[";
+        for (size_t i = 0; i < files.size(); i++) {
+            out << (i ? ",\n\t\t" : "\n\t\t") << nlohmann::json(files[i]).dump();
+        }
+        out << "\n\t]";
+    }
+    out << "\n}";
+
+    return std::move(out).str();
+}
+
+fusion::cem_ext_manifest fusion::cem_ext_manifest::from_json_object(const nlohmann::ordered_json& j) {
+    cem_ext_manifest ext = {};
+
+    try {
+        ext.mfxname = j.at("mfxname").get<std::string>();
+        ext.name = j.at("name").get<std::string>();
+        ext.author = j.at("author").get<std::string>();
+        ext.description = j.at("description").get<std::string>();
+        ext.website = j.at("website").get<std::string>();
+        ext.dev = j.at("dev").get<std::string>() == "yes";
+        ext.platforms = parse_supported_platforms(j.at("platforms").get<std::string>());
+        ext.time = parse_last_modification_time(j.at("time").get<std::string>());
+        ext.download = j.at("download").get<std::string>();
+        ext.zipsize = std::stoull(j.at("zipsize").get<std::string>());
+
+        for (auto&& f : j.at("files")) {
+            ext.files.push_back(f.get<std::string>());
+        }
+
+        if(j.contains("footprint")) {
+            ext.footprint = parse_footprint(j.at("footprint"));
+        }
+
+        if(j.contains("run_infos")) {
+            ext.run_infos = parse_run_infos(j.at("run_infos"));
+        }
+    }
+    catch(const std::exception& e) {
+        throw create_except<std::runtime_error>("Bad extension manifest: %s", e.what());
+    }
+
+    return ext;
 }
 
 
 
+fusion::extension::~extension() {
+    // Unloaded even if probing threw, a batch run would keep every mfx mapped otherwise.
+    try {
+        close();
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+
+#ifndef NO_EXT_LOAD
 void fusion::extension::open(std::filesystem::path mfx_path) {
+    if(is_open()) {
+        close();
+    }
+
     auto mfx_path_str = std::filesystem::absolute(mfx_path).string();
-    module_handle = LoadLibraryExW(to_utf16(mfx_path_str).c_str(), NULL, LOAD_LIBRARY_SEARCH_APPLICATION_DIR | LOAD_LIBRARY_SEARCH_SYSTEM32);
+    // Bundled dlls are staged next to the mfx, mmfs2.dll is next to cem-tool.
+    module_handle = LoadLibraryExW(to_utf16(mfx_path_str).c_str(), NULL, LOAD_LIBRARY_SEARCH_DLL_LOAD_DIR | LOAD_LIBRARY_SEARCH_APPLICATION_DIR | LOAD_LIBRARY_SEARCH_SYSTEM32);
 
     if(module_handle == nullptr) {
         throw create_except("Failed to load extension '%s': %s.", mfx_path_str.c_str(), last_system_error().c_str());
@@ -119,6 +360,10 @@ void fusion::extension::open(std::filesystem::path mfx_path) {
 }
 
 void fusion::extension::close() {
+    if(!module_handle) {
+        return;
+    }
+
     if(!FreeLibrary((HMODULE)module_handle)) {
         throw create_except("FreeLibrary failed: %s.", last_system_error().c_str());
     }
@@ -190,4 +435,119 @@ void* fusion::extension::get_proc(void* handle, const std::string& proc) {
     }
 
     return (void*)ret;
-}
\ No newline at end of file
+}
+#else
+void fusion::extension::open(std::filesystem::path mfx_path) {
+    throw create_except("Failed to load extension '%s': This build of cem-tool cant load extensions (NO_EXT_LOAD).", std::filesystem::absolute(mfx_path).string().c_str());
+}
+
+void fusion::extension::close() {
+    module_handle = 0;
+}
+
+bool fusion::extension::is_open() {
+    return false;
+}
+
+// Never called, open() always fails.
+short fusion::extension::Initialize(int quiet) {
+    return 0;
+}
+
+int fusion::extension::Free() {
+    return 0;
+}
+
+std::uint32_t fusion::extension::GetInfos(ext_general_infos info) {
+    return 0;
+}
+
+short fusion::extension::GetRunObjectInfos(ext_run_infos* infos_ptr) {
+    return 0;
+}
+
+void fusion::extension::GetObjInfos(ext_infos* infos_ptr) {}
+
+void* fusion::extension::get_proc(void* handle, const std::string& proc) {
+    return nullptr;
+}
+#endif
+
+
+
+std::string fusion::ext_probe::to_json() const {
+    nlohmann::ordered_json j = {
+        {"name", infos.name},
+        {"author", infos.author},
+        {"copyright", infos.copyright},
+        {"comment", infos.comment},
+        {"website", infos.website},
+        {"product", product},
+        {"build", build},
+        {"unicode", unicode},
+    };
+
+    if(run_infos) {
+        j["run_infos"] = run_infos_object(*run_infos);
+    }
+
+    return j.dump();
+}
+
+fusion::ext_probe fusion::ext_probe::from_json(const std::string& json) {
+    ext_probe ret = {};
+
+    try {
+        auto j = nlohmann::ordered_json::parse(json);
+
+        ret.infos.name = j.at("name").get<std::string>();
+        ret.infos.author = j.at("author").get<std::string>();
+        ret.infos.copyright = j.at("copyright").get<std::string>();
+        ret.infos.comment = j.at("comment").get<std::string>();
+        ret.infos.website = j.at("website").get<std::string>();
+        ret.product = j.at("product").get<std::uint32_t>();
+        ret.build = j.at("build").get<std::uint32_t>();
+        ret.unicode = j.at("unicode").get<bool>();
+
+        if(j.contains("run_infos")) {
+            ret.run_infos = parse_run_infos(j.at("run_infos"));
+        }
+    }
+    catch(const nlohmann::json::exception& e) {
+        throw create_except<std::runtime_error>("Bad probe output: %s", e.what());
+    }
+
+    return ret;
+}
+
+
+fusion::ext_probe fusion::probe_extension(const std::filesystem::path& mfx_path, bool run_infos) {
+    ext_probe ret = {};
+    extension ext;
+
+    ext.open(mfx_path);
+    ext.Initialize(1);
+
+    ret.product = ext.GetInfos(ext_general_infos::product);
+    ret.build = ext.GetInfos(ext_general_infos::build);
+    ret.unicode = ext.GetInfos(ext_general_infos::unicode);
+    ext.GetObjInfos(&ret.infos);
+
+    // Only when asked for, extensions that crash in it would lose everything above.
+    // Pointers to ace infos are only valid while loaded, only counts are kept.
+    ext_run_infos infos = {};
+    if(run_infos && ext.GetRunObjectInfos(&infos)) {
+        ret.run_infos = ext_run_summary{
+            infos.identifier,
+            infos.version,
+            infos.edit_flags,
+            static_cast<std::uint32_t>(std::max<short>(infos.num_of_conditions, 0)),
+            static_cast<std::uint32_t>(std::max<short>(infos.num_of_actions, 0)),
+            static_cast<std::uint32_t>(std::max<short>(infos.num_of_expressions, 0)),
+        };
+    }
+
+    ext.Free();
+    ext.close();
+    return ret;
+}
@@ -5,6 +5,20 @@
 #include <vector>
 #include <filesystem>
 #include <cstdint>
+#include <optional>
+
+#include "nlohmann/json_fwd.hpp"
+#include "path_table.hpp"
+
+// Extensions are 32bit windows dlls, everywhere else only the json side works.
+#if !defined(_WIN32) && !defined(NO_EXT_LOAD)
+#define NO_EXT_LOAD
+#endif
+
+// Calling convention of extension functions, only exists on 32bit windows.
+#if !defined(_WIN32) && !defined(__stdcall)
+#define __stdcall
+#endif
 
 
 
@@ -38,6 +52,32 @@ namespace fusion {
     std::uint32_t platform_enum_to_index(platform platform_enum);
     platform platform_index_to_enum(std::uint32_t platform_index);
 
+    // Bytes taken in the zip file and after extraction.
+    struct footprint_size {
+        std::uint64_t compressed;
+        std::uint64_t uncompressed;
+    };
+
+    // Download and install cost of an extension, from zip central directory sizes.
+    struct ext_footprint {
+        footprint_size platforms[8];        // Data/Runtime files of each platform (platform enum index)
+        footprint_size extensions;          // Extensions/, editor files
+        footprint_size runtime;             // Data/, all platforms together
+        footprint_size help;
+        footprint_size examples;
+        footprint_size other;               // Anything else
+    };
+
+    // Runtime object infos from GetRunObjectInfos().
+    struct ext_run_summary {
+        std::uint32_t identifier;           // Four character code, unique per extension
+        std::int32_t version;               // Edit data version
+        std::uint32_t edit_flags;           // OEFLAGS
+        std::uint32_t conditions;
+        std::uint32_t actions;
+        std::uint32_t expressions;
+    };
+
     // json file with extension info used by extension manager
     struct cem_ext_manifest {
         std::string mfxname;                // Extension mfx file name
@@ -50,9 +90,16 @@ namespace fusion {
         std::string download;               // Download link or lower case mfxname if ext is stored on clickteams server
         time_t time;                        // Modification date and time of the most recent file inside the zip file, used by fusion for update checks
         std::uintmax_t zipsize;             // Size of zip archive
-        std::vector<std::string> files;     // List of all files inside zip archive
+        path_table files;                   // List of all files inside zip archive
+        std::optional<ext_footprint> footprint;     // Not part of clickteam format, only written if set
+        std::optional<ext_run_summary> run_infos;   // Same
+
+        // Files go straight from the path table into the string, without a json array copy of them.
+        std::string to_json() const;
 
-        std::string to_json();
+        // Same fields as to_json() but as json object, used to build catalogs.
+        nlohmann::ordered_json to_json_object() const;
+        static cem_ext_manifest from_json_object(const nlohmann::ordered_json& j);
     };
 
 
@@ -260,7 +307,11 @@ namespace fusion {
     class extension {
     public:
         extension() = default;
-        ~extension() = default;
+        ~extension();
+
+        // Owns the module handle.
+        extension(const extension&) = delete;
+        extension& operator=(const extension&) = delete;
 
         void open(std::filesystem::path mfx_path);
         void close();
@@ -293,4 +344,22 @@ namespace fusion {
             api::ext_funcs::GetObjInfosW GetObjInfosW;
         } funcs;
     };
+
+
+    // Everything cem-tool reads from an editor mfx.
+    // Probes run in separate cem-tool processes ('cem-tool probe') and send results back as json.
+    struct ext_probe {
+        ext_infos infos;
+        std::uint32_t product;              // 3 = Developer, 2 = Standard, 1 = TGF.
+        std::uint32_t build;
+        bool unicode;
+        std::optional<ext_run_summary> run_infos;   // Empty if GetRunObjectInfos() failed (or older probe command)
+
+        std::string to_json() const;
+        static ext_probe from_json(const std::string& json);
+    };
+
+    // Load the mfx, collect ext_probe and unload it. Everything comes from one load and Initialize().
+    // GetRunObjectInfos() is only called with run_infos.
+    ext_probe probe_extension(const std::filesystem::path& mfx_path, bool run_infos);
 }
\ No newline at end of file
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+#include "http_file.hpp"
+#include "metrics.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+
+
+
+// Server that stops answering fails the zip file instead of hanging forever.
+static constexpr std::chrono::seconds socket_timeout{30};
+
+
+#ifdef _WIN32
+using socket_handle = SOCKET;
+static constexpr socket_handle no_socket = INVALID_SOCKET;
+
+static void close_socket(socket_handle s) {
+    closesocket(s);
+}
+
+static void set_timeout(socket_handle s) {
+    DWORD timeout = static_cast<DWORD>(std::chrono::milliseconds(socket_timeout).count());
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+static void init_sockets() {
+    static bool initialized = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+
+    if(!initialized) {
+        throw std::runtime_error("WSAStartup failed.");
+    }
+}
+#else
+using socket_handle = int;
+static constexpr socket_handle no_socket = -1;
+
+static void close_socket(socket_handle s) {
+    close(s);
+}
+
+static void set_timeout(socket_handle s) {
+    timeval timeout = {static_cast<time_t>(socket_timeout.count()), 0};
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static void init_sockets() {}
+#endif
+
+
+namespace {
+    struct connection {
+        socket_handle s = no_socket;
+
+        ~connection() {
+            if(s != no_socket) {
+                close_socket(s);
+            }
+        }
+    };
+
+    struct http_response {
+        int status = 0;
+        std::string headers;                // Lower case, "name: value\r\n" each
+        std::vector<std::uint8_t> body;
+
+        std::string header(const std::string& name) const {
+            auto start = headers.find("\r\n" + name + ":");
+            if(start == std::string::npos) {
+                return "";
+            }
+
+            start += name.size() + 3;
+            auto end = headers.find("\r\n", start);
+            auto value = headers.substr(start, end - start);
+            value.erase(0, value.find_first_not_of(' '));
+            return value;
+        }
+    };
+}
+
+
+bool is_http_url(std::string_view str) {
+    return str.starts_with("http://");
+}
+
+
+http_file::http_file(const std::string& url) : url(url) {
+    if(!is_http_url(url)) {
+        throw create_except("Not a http url '%s', only http:// is supported.", url.c_str());
+    }
+
+    auto authority_start = std::string_view("http://").size();
+    auto path_start = url.find('/', authority_start);
+
+    host = url.substr(authority_start, path_start - authority_start);
+    path = path_start == std::string::npos ? "/" : url.substr(path_start);
+
+    auto port_start = host.rfind(':');
+    if(port_start != std::string::npos && host.find(']', port_start) == std::string::npos) {
+        port = host.substr(port_start + 1);
+        host.erase(port_start);
+    }
+
+    // [::1] style ipv6 address
+    if(host.starts_with('[') && host.ends_with(']')) {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    if(host.empty()) {
+        throw create_except("Bad url '%s': No host.", url.c_str());
+    }
+}
+
+
+std::string http_file::filename() {
+    auto end = path.find_first_of("?#");
+    auto file_path = path.substr(0, end);
+    return file_path.substr(file_path.rfind('/') + 1);
+}
+
+std::uint64_t http_file::size() {
+    return file_size;
+}
+
+std::uint64_t http_file::bytes_downloaded() {
+    return downloaded;
+}
+
+
+static http_response parse_response(std::vector<std::uint8_t> data, const std::string& url) {
+    http_response response;
+
+    std::string_view text(reinterpret_cast<const char*>(data.data()), data.size());
+    auto header_end = text.find("\r\n\r\n");
+    if(header_end == std::string_view::npos || std::sscanf(std::string(text.substr(0, 16)).c_str(), "HTTP/%*d.%*d %d", &response.status) != 1) {
+        throw create_except("Bad http response from '%s'.", url.c_str());
+    }
+
+    response.headers = std::string(text.substr(text.find("\r\n"), header_end - text.find("\r\n") + 2));
+    for (auto &&c : response.headers) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    data.erase(data.begin(), data.begin() + header_end + 4);
+
+    if(response.header("transfer-encoding").find("chunked") != std::string::npos) {
+        // <hex size>\r\n<data>\r\n ... 0\r\n\r\n
+        size_t position = 0;
+        while(true) {
+            auto line_end = std::search(data.begin() + position, data.end(), "\r\n", "\r\n" + 2);
+            if(line_end == data.end()) {
+                throw create_except("Bad chunked http response from '%s'.", url.c_str());
+            }
+
+            unsigned long long chunk_size = 0;
+            auto size_end = std::from_chars(reinterpret_cast<const char*>(data.data()) + position, reinterpret_cast<const char*>(data.data()) + (line_end - data.begin()), chunk_size, 16).ptr;
+            if(size_end == reinterpret_cast<const char*>(data.data()) + position) {
+                throw create_except("Bad chunked http response from '%s'.", url.c_str());
+            }
+            position = (line_end - data.begin()) + 2;
+
+            if(chunk_size == 0) {
+                break;
+            }
+
+            // Chunk and its \r\n have to be there, the next search starts after them.
+            if(chunk_size > data.size() - position || data.size() - position - chunk_size < 2) {
+                throw create_except("Truncated chunked http response from '%s'.", url.c_str());
+            }
+
+            response.body.insert(response.body.end(), data.begin() + position, data.begin() + position + chunk_size);
+            position += chunk_size + 2;
+        }
+    } else {
+        response.body = std::move(data);
+
+        auto content_length = response.header("content-length");
+        if(!content_length.empty() && std::stoull(content_length) < response.body.size()) {
+            response.body.resize(std::stoull(content_length));
+        }
+    }
+
+    return response;
+}
+
+// One connection per request, zip files only need a few.
+std::vector<std::uint8_t> http_file::request(const std::string& range) {
+    init_sockets();
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses = nullptr;
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        throw create_except("Failed to resolve '%s'.", host.c_str());
+    }
+
+    connection c;
+    for (auto a = addresses; a; a = a->ai_next) {
+        c.s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if(c.s == no_socket) {
+            continue;
+        }
+
+        set_timeout(c.s);
+        if(connect(c.s, a->ai_addr, static_cast<int>(a->ai_addrlen)) == 0) {
+            break;
+        }
+
+        close_socket(c.s);
+        c.s = no_socket;
+    }
+    freeaddrinfo(addresses);
+
+    if(c.s == no_socket) {
+        throw create_except("Failed to connect to '%s:%s'.", host.c_str(), port.c_str());
+    }
+
+    // Ipv6 addresses keep their brackets in the header, like in the url.
+    auto host_header = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+
+    auto request = "GET " + path + " HTTP/1.1\r\n"
+                   "Host: " + host_header + (port == "80" ? "" : ":" + port) + "\r\n"
+                   "Range: bytes=" + range + "\r\n"
+                   "User-Agent: cem-tool\r\n"
+                   "Connection: close\r\n\r\n";
+
+    for (size_t sent = 0; sent < request.size();) {
+        auto n = send(c.s, request.data() + sent, static_cast<int>(request.size() - sent), 0);
+        if(n <= 0) {
+            throw create_except("Failed to send http request to '%s'.", url.c_str());
+        }
+        sent += n;
+    }
+
+    // Server closes the connection after the response.
+    std::vector<std::uint8_t> data;
+    char buffer[65536];
+    while(true) {
+        auto n = recv(c.s, buffer, sizeof(buffer), 0);
+        if(n < 0) {
+            throw create_except("Failed to read http response from '%s'.", url.c_str());
+        }
+        if(n == 0) {
+            break;
+        }
+        data.insert(data.end(), buffer, buffer + n);
+    }
+
+    downloaded += data.size();
+    metrics::add(metrics::counter::bytes_read, data.size());
+
+    auto response = parse_response(std::move(data), url);
+
+    // Range starts past the end, only happens for empty files.
+    unsigned long long first = 0, last = 0, total = 0;
+    if(response.status == 416 && std::sscanf(response.header("content-range").c_str(), "bytes */%llu", &total) == 1) {
+        file_size = total;
+        size_known = true;
+        return {};
+    }
+
+    if(response.status == 200) {
+        throw create_except("Server of '%s' doesnt support range requests.", url.c_str());
+    }
+
+    if(response.status != 206) {
+        throw create_except("Http request for '%s' failed with status %d.", url.c_str(), response.status);
+    }
+
+    if(std::sscanf(response.header("content-range").c_str(), "bytes %llu-%llu/%llu", &first, &last, &total) != 3 || last < first || response.body.size() != last - first + 1) {
+        throw create_except("Bad range response from '%s'.", url.c_str());
+    }
+
+    file_size = total;
+    size_known = true;
+    return std::move(response.body);
+}
+
+
+std::vector<std::uint8_t> http_file::read_tail(std::uint64_t length) {
+    return request("-" + std::to_string(length));
+}
+
+std::vector<std::uint8_t> http_file::read(std::uint64_t offset, std::uint64_t length) {
+    if(size_known) {
+        if(offset >= file_size) {
+            return {};
+        }
+        length = std::min(length, file_size - offset);
+    }
+
+    if(length == 0) {
+        return {};
+    }
+
+    return request(std::to_string(offset) + "-" + std::to_string(offset + length - 1));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Read only access to a file on a http server with range requests, so only the parts
+// of a zip file that are needed get downloaded. Plain http only, no tls.
+
+
+
+bool is_http_url(std::string_view str);
+
+
+class http_file {
+public:
+    http_file(const std::string& url);
+
+    // Last length bytes (or whole file if smaller), also learns file size.
+    std::vector<std::uint8_t> read_tail(std::uint64_t length);
+
+    // Bytes [offset, offset + length), less at end of file.
+    std::vector<std::uint8_t> read(std::uint64_t offset, std::uint64_t length);
+
+    // Known after first read.
+    std::uint64_t size();
+    std::uint64_t bytes_downloaded();
+
+    // Last path segment, like a file name.
+    std::string filename();
+
+private:
+    std::string url;
+    std::string host;
+    std::string port = "80";
+    std::string path;
+    std::uint64_t file_size = 0;
+    bool size_known = false;
+    std::uint64_t downloaded = 0;
+
+    std::vector<std::uint8_t> request(const std::string& range);
+};
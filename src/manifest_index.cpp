@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+#include "manifest_index.hpp"
+#include "string_helper.hpp"
+#include "metrics.hpp"
+
+#include "nlohmann/json.hpp"
+
+
+
+static constexpr std::uint32_t index_version = 1;
+
+
+// Lower case words, anything that isnt ascii letter or digit splits words (utf8 bytes are kept).
+static std::vector<std::string> tokenize(std::string_view text) {
+    std::vector<std::string> tokens;
+    std::string token;
+
+    for (auto &&c : text) {
+        auto u = static_cast<unsigned char>(c);
+
+        if(std::isalnum(u) || u >= 0x80) {
+            token.push_back(static_cast<char>(u < 0x80 ? std::tolower(u) : u));
+            continue;
+        }
+
+        if(!token.empty()) {
+            tokens.push_back(std::move(token));
+            token.clear();
+        }
+    }
+
+    if(!token.empty()) {
+        tokens.push_back(std::move(token));
+    }
+
+    return tokens;
+}
+
+static std::int64_t modified_time(const std::filesystem::path& file_path) {
+    return std::filesystem::last_write_time(file_path).time_since_epoch().count();
+}
+
+
+
+void manifest_index::load(const std::filesystem::path& file_path) {
+    std::ifstream input(file_path, std::ios::binary);
+
+    if(!input) {
+        throw create_except<std::runtime_error>("Failed to open index '%s'.", file_path.string().c_str());
+    }
+
+    try {
+        auto j = nlohmann::json::from_msgpack(input);
+
+        if(j.at("version").get<std::uint32_t>() != index_version) {
+            throw std::runtime_error("Unsupported index version.");
+        }
+
+        documents.clear();
+        sources.clear();
+
+        for (auto &&d : j.at("documents")) {
+            documents.push_back({d.at(0).get<std::string>(), d.at(1).get<std::string>(), d.at(2).get<std::uint32_t>(), false});
+        }
+
+        for (auto &&[path, s] : j.at("sources").items()) {
+            sources[path] = {s.at(0).get<std::int64_t>(), s.at(1).get<std::uintmax_t>()};
+        }
+
+        for (size_t f = 0; f < field_count; f++) {
+            postings[f].clear();
+
+            for (auto &&[token, ids] : j.at("terms").at(field_names[f]).items()) {
+                postings[f][token] = ids.get<std::vector<std::uint32_t>>();
+            }
+        }
+    }
+    catch(const std::exception& e) {
+        throw create_except<std::runtime_error>("Bad index '%s': %s", file_path.string().c_str(), e.what());
+    }
+
+    build_platform_bitmaps();
+}
+
+std::vector<std::uint8_t> manifest_index::to_msgpack() {
+    compact();
+
+    nlohmann::json j;
+    j["version"] = index_version;
+
+    auto &&j_documents = j["documents"] = nlohmann::json::array();
+    for (auto &&d : documents) {
+        j_documents.push_back({d.mfxname, d.source, d.platforms});
+    }
+
+    auto &&j_sources = j["sources"] = nlohmann::json::object();
+    for (auto &&[path, s] : sources) {
+        j_sources[path] = {s.modified, s.size};
+    }
+
+    for (size_t f = 0; f < field_count; f++) {
+        auto &&j_terms = j["terms"][field_names[f]] = nlohmann::json::object();
+        for (auto &&[token, ids] : postings[f]) {
+            j_terms[token] = ids;
+        }
+    }
+
+    return nlohmann::json::to_msgpack(j);
+}
+
+
+bool manifest_index::update_source(const std::filesystem::path& source_path) {
+    auto source = std::filesystem::absolute(source_path).string();
+    source_info info = {modified_time(source_path), std::filesystem::file_size(source_path)};
+
+    auto it = sources.find(source);
+    if(it != sources.end() && it->second.modified == info.modified && it->second.size == info.size) {
+        metrics::add(metrics::counter::cache_hits);
+        return false;
+    }
+
+    metrics::add(metrics::counter::cache_misses);
+
+    std::ifstream input(source_path);
+    nlohmann::ordered_json j;
+
+    try {
+        j = nlohmann::ordered_json::parse(input);
+    }
+    catch(const nlohmann::json::exception& e) {
+        throw create_except<std::runtime_error>("Failed to parse '%s': %s", source.c_str(), e.what());
+    }
+
+    // Parse everything before touching the index, a bad file shouldnt remove old documents.
+    std::vector<fusion::cem_ext_manifest> manifests;
+    if(j.is_array()) {
+        for (auto &&e : j) {
+            manifests.push_back(fusion::cem_ext_manifest::from_json_object(e));
+        }
+    } else {
+        manifests.push_back(fusion::cem_ext_manifest::from_json_object(j));
+    }
+
+    remove_source_documents(source);
+
+    for (auto &&m : manifests) {
+        add_document(m, source);
+    }
+
+    sources[source] = info;
+    build_platform_bitmaps();
+    return true;
+}
+
+std::size_t manifest_index::remove_missing_sources() {
+    std::vector<std::string> missing;
+
+    for (auto &&[path, info] : sources) {
+        if(!std::filesystem::exists(path)) {
+            missing.push_back(path);
+        }
+    }
+
+    for (auto &&path : missing) {
+        remove_source_documents(path);
+        sources.erase(path);
+    }
+
+    build_platform_bitmaps();
+    return missing.size();
+}
+
+
+std::size_t manifest_index::size() const {
+    return std::count_if(documents.begin(), documents.end(), [](const document& d) {
+        return !d.removed;
+    });
+}
+
+std::vector<std::filesystem::path> manifest_index::source_paths() const {
+    std::vector<std::filesystem::path> ret;
+
+    for (auto &&[path, info] : sources) {
+        ret.push_back(path);
+    }
+
+    return ret;
+}
+
+
+void manifest_index::add_document(const fusion::cem_ext_manifest& ext_man, const std::string& source) {
+    auto id = static_cast<std::uint32_t>(documents.size());
+    documents.push_back({ext_man.mfxname, source, ext_man.platforms, false});
+
+    std::set<std::string> field_tokens[field_count];
+    for (auto &&t : tokenize(ext_man.name)) field_tokens[name].insert(t);
+    for (auto &&t : tokenize(ext_man.author)) field_tokens[author].insert(t);
+    for (auto &&t : tokenize(ext_man.description)) field_tokens[description].insert(t);
+    for (auto &&f : ext_man.files) {
+        for (auto &&t : tokenize(f)) field_tokens[files].insert(t);
+    }
+
+    // New ids are always the biggest so lists stay sorted.
+    for (size_t f = 0; f < field_count; f++) {
+        for (auto &&t : field_tokens[f]) {
+            postings[f][t].push_back(id);
+        }
+    }
+}
+
+void manifest_index::remove_source_documents(const std::string& source) {
+    std::vector<std::uint32_t> removed;
+
+    for (std::uint32_t i = 0; i < documents.size(); i++) {
+        if(!documents[i].removed && documents[i].source == source) {
+            documents[i].removed = true;
+            removed.push_back(i);
+        }
+    }
+
+    if(removed.empty()) {
+        return;
+    }
+
+    for (auto &&field_postings : postings) {
+        for (auto it = field_postings.begin(); it != field_postings.end();) {
+            auto &&ids = it->second;
+            std::vector<std::uint32_t> kept;
+            std::set_difference(ids.begin(), ids.end(), removed.begin(), removed.end(), std::back_inserter(kept));
+            ids = std::move(kept);
+
+            it = ids.empty() ? field_postings.erase(it) : std::next(it);
+        }
+    }
+}
+
+// Drop removed documents and renumber the rest, relative order stays the same so lists stay sorted.
+void manifest_index::compact() {
+    if(size() == documents.size()) {
+        return;
+    }
+
+    std::vector<std::uint32_t> new_ids(documents.size());
+    std::vector<document> kept;
+
+    for (size_t i = 0; i < documents.size(); i++) {
+        new_ids[i] = static_cast<std::uint32_t>(kept.size());
+        if(!documents[i].removed) {
+            kept.push_back(std::move(documents[i]));
+        }
+    }
+
+    documents = std::move(kept);
+
+    for (auto &&field_postings : postings) {
+        for (auto &&[token, ids] : field_postings) {
+            for (auto &&id : ids) {
+                id = new_ids[id];
+            }
+        }
+    }
+
+    build_platform_bitmaps();
+}
+
+void manifest_index::build_platform_bitmaps() {
+    for (std::uint32_t p = 0; p < std::size(platform_bitmaps); p++) {
+        auto &&b = platform_bitmaps[p];
+        b.assign((documents.size() + 63) / 64, 0);
+
+        for (size_t i = 0; i < documents.size(); i++) {
+            if(!documents[i].removed && (documents[i].platforms & fusion::platform_index_to_enum(p))) {
+                b[i / 64] |= std::uint64_t(1) << (i % 64);
+            }
+        }
+    }
+}
+
+
+std::vector<std::string> manifest_index::query(const std::vector<std::string>& terms) const {
+    bitmap result((documents.size() + 63) / 64, ~std::uint64_t(0));
+
+    for (auto &&term : terms) {
+        auto b = term_bitmap(term);
+        for (size_t w = 0; w < result.size(); w++) {
+            result[w] &= b[w];
+        }
+    }
+
+    std::vector<std::string> ret;
+    for (size_t i = 0; i < documents.size(); i++) {
+        if(!documents[i].removed && (result[i / 64] >> (i % 64) & 1)) {
+            ret.push_back(documents[i].mfxname);
+        }
+    }
+
+    // Same extension can be in more sources (manifest and catalog).
+    std::sort(ret.begin(), ret.end());
+    ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+    return ret;
+}
+
+manifest_index::bitmap manifest_index::term_bitmap(const std::string& term) const {
+    std::string field_name;
+    std::string value = term;
+
+    auto colon = term.find(':');
+    if(colon != std::string::npos) {
+        field_name = term.substr(0, colon);
+        value = term.substr(colon + 1);
+    }
+
+    if(field_name == "platform") {
+        return platform_bitmap(value);
+    }
+
+    // No field means any text field.
+    std::vector<field> fields;
+    for (size_t f = 0; f < field_count; f++) {
+        if(field_name.empty() || field_name == field_names[f]) {
+            fields.push_back(static_cast<field>(f));
+        }
+    }
+
+    if(fields.empty()) {
+        throw create_except<std::runtime_error>("Unknown field '%s' in '%s'.", field_name.c_str(), term.c_str());
+    }
+
+    auto tokens = tokenize(value);
+    if(tokens.empty()) {
+        throw create_except<std::runtime_error>("Nothing to search for in '%s'.", term.c_str());
+    }
+
+    if(value.back() == '*') {
+        tokens.back().push_back('*');
+    }
+
+    bitmap ret((documents.size() + 63) / 64, ~std::uint64_t(0));
+
+    for (auto &&t : tokens) {
+        bitmap any_field(ret.size(), 0);
+
+        for (auto &&f : fields) {
+            auto b = token_bitmap(f, t);
+            for (size_t w = 0; w < any_field.size(); w++) {
+                any_field[w] |= b[w];
+            }
+        }
+
+        for (size_t w = 0; w < ret.size(); w++) {
+            ret[w] &= any_field[w];
+        }
+    }
+
+    return ret;
+}
+
+manifest_index::bitmap manifest_index::token_bitmap(field f, const std::string& token) const {
+    bitmap ret((documents.size() + 63) / 64, 0);
+
+    auto set_ids = [&](const std::vector<std::uint32_t>& ids) {
+        for (auto &&id : ids) {
+            ret[id / 64] |= std::uint64_t(1) << (id % 64);
+        }
+    };
+
+    if(!token.empty() && token.back() == '*') {
+        auto prefix = token.substr(0, token.size() - 1);
+
+        for (auto it = postings[f].lower_bound(prefix); it != postings[f].end() && it->first.starts_with(prefix); it++) {
+            set_ids(it->second);
+        }
+    } else {
+        auto it = postings[f].find(token);
+        if(it != postings[f].end()) {
+            set_ids(it->second);
+        }
+    }
+
+    return ret;
+}
+
+manifest_index::bitmap manifest_index::platform_bitmap(const std::string& platform) const {
+    for (std::uint32_t p = 0; p < std::size(platform_bitmaps); p++) {
+        std::string platform_name = fusion::platform_names[p];
+
+        if(std::equal(platform.begin(), platform.end(), platform_name.begin(), platform_name.end(), [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+        })) {
+            return platform_bitmaps[p];
+        }
+    }
+
+    throw create_except<std::runtime_error>("Unknown platform '%s'.", platform.c_str());
+}
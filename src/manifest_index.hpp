@@ -0,0 +1,78 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "fusion_ext.hpp"
+
+// Inverted index over manifest and catalog files for 'cem-tool index' and 'cem-tool query'.
+// Tokens from name, author, description and files point to sorted lists of documents (one per extension),
+// platforms are bitmaps. Sources remember size and modification time so only changed files get parsed again.
+
+
+
+class manifest_index {
+public:
+    manifest_index() = default;
+    ~manifest_index() = default;
+
+    void load(const std::filesystem::path& file_path);
+
+    // Index file contents for load(), drops documents of removed sources first.
+    std::vector<std::uint8_t> to_msgpack();
+
+    // Index manifest or catalog json file, returns false if it didnt change since last update.
+    bool update_source(const std::filesystem::path& source_path);
+
+    // Forget documents from sources that were deleted, returns number of removed sources.
+    std::size_t remove_missing_sources();
+
+    // All terms have to match, returns matching mfxnames sorted.
+    // Terms: 'word', 'field:word' where field is name, author, description, file or platform, 'word*' for prefix.
+    std::vector<std::string> query(const std::vector<std::string>& terms) const;
+
+    std::size_t size() const;
+    std::vector<std::filesystem::path> source_paths() const;
+
+private:
+    enum field : std::size_t {
+        name,
+        author,
+        description,
+        files,
+        field_count
+    };
+
+    static constexpr const char* field_names[field_count] = {"name", "author", "description", "file"};
+
+    struct document {
+        std::string mfxname;
+        std::string source;
+        std::uint32_t platforms;
+        bool removed;
+    };
+
+    struct source_info {
+        std::int64_t modified;
+        std::uintmax_t size;
+    };
+
+    using bitmap = std::vector<std::uint64_t>;
+
+    std::vector<document> documents;
+    std::map<std::string, source_info> sources;
+    std::map<std::string, std::vector<std::uint32_t>> postings[field_count];
+    bitmap platform_bitmaps[8];             // fusion::platform bits, rebuilt from documents
+
+    void add_document(const fusion::cem_ext_manifest& ext_man, const std::string& source);
+    void remove_source_documents(const std::string& source);
+    void compact();
+    void build_platform_bitmaps();
+
+    bitmap term_bitmap(const std::string& term) const;
+    bitmap token_bitmap(field f, const std::string& token) const;
+    bitmap platform_bitmap(const std::string& platform) const;
+};
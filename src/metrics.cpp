@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <fstream>
+
+#include "nlohmann/json.hpp"
+
+#include "metrics.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+
+std::atomic<bool> metrics::enabled = false;
+thread_local std::atomic<std::uint64_t>* metrics::stage_sums = nullptr;
+
+static std::atomic<std::uint64_t> counters[(size_t)metrics::counter::count] = {};
+static metrics::histogram latencies[(size_t)metrics::stage::count];
+
+// Matches counter enum
+static const char* counter_names[][2] = {
+    {"archives_processed", "Zip files processed successfully."},
+    {"archives_failed", "Zip files that failed to process."},
+    {"bytes_read", "Compressed bytes read from zip files."},
+    {"bytes_inflated", "Bytes decompressed from zip files."},
+    {"probe_successes", "Editor mfx variants loaded successfully."},
+    {"probe_failures", "Editor mfx variants that failed to load."},
+    {"probe_timeouts", "Editor mfx variants killed after the probe timeout."},
+    {"cache_hits", "Inputs skipped because they didnt change."},
+    {"cache_misses", "Inputs that had to be processed again."},
+};
+
+// Matches stage enum
+static const char* stage_names[] = {
+    "open",
+    "list",
+    "sanity_check",
+    "extract",
+    "probe",
+    "write",
+    "archive",
+};
+
+
+
+void metrics::histogram::record(std::uint64_t value) {
+    buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+    total_count.fetch_add(1, std::memory_order_relaxed);
+    total_sum.fetch_add(value, std::memory_order_relaxed);
+
+    auto current = max_value.load(std::memory_order_relaxed);
+    while(current < value && !max_value.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+std::uint64_t metrics::histogram::count() const {
+    return total_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t metrics::histogram::sum() const {
+    return total_sum.load(std::memory_order_relaxed);
+}
+
+std::uint64_t metrics::histogram::max() const {
+    return max_value.load(std::memory_order_relaxed);
+}
+
+// Highest value in the bucket where quantile of all values is reached.
+std::uint64_t metrics::histogram::percentile(double quantile) const {
+    std::uint64_t total = 0;
+    for (auto &&b : buckets) {
+        total += b.load(std::memory_order_relaxed);
+    }
+
+    if(!total) {
+        return 0;
+    }
+
+    auto target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(quantile * total + 0.5));
+    std::uint64_t seen = 0;
+
+    for (unsigned i = 0; i < bucket_count; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+
+        if(seen >= target) {
+            return std::min(bucket_upper_bound(i), max());
+        }
+    }
+
+    return max();
+}
+
+unsigned metrics::histogram::bucket_index(std::uint64_t value) {
+    if(value < sub_bucket_count) {
+        return static_cast<unsigned>(value);
+    }
+
+    unsigned exponent = std::bit_width(value) - 1;
+    unsigned sub_bucket = (value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1);
+    return (exponent - sub_bucket_bits + 1) * sub_bucket_count + sub_bucket;
+}
+
+std::uint64_t metrics::histogram::bucket_upper_bound(unsigned index) {
+    if(index < sub_bucket_count) {
+        return index;
+    }
+
+    unsigned exponent = index / sub_bucket_count + sub_bucket_bits - 1;
+    std::uint64_t sub_bucket = index % sub_bucket_count;
+    std::uint64_t lower = (sub_bucket_count + sub_bucket) << (exponent - sub_bucket_bits);
+
+    return lower + ((std::uint64_t)1 << (exponent - sub_bucket_bits)) - 1;
+}
+
+
+
+void metrics::add_enabled(counter c, std::uint64_t value) {
+    counters[(size_t)c].fetch_add(value, std::memory_order_relaxed);
+}
+
+void metrics::record_enabled(stage s, std::chrono::steady_clock::duration duration) {
+    latencies[(size_t)s].record(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+}
+
+std::uint64_t metrics::value(counter c) {
+    return counters[(size_t)c].load(std::memory_order_relaxed);
+}
+
+const metrics::histogram& metrics::latency(stage s) {
+    return latencies[(size_t)s];
+}
+
+
+std::uint64_t metrics::peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;    // kilobytes on linux
+#endif
+}
+
+
+std::string metrics::prometheus_text() {
+    std::string ret;
+    char line[256];
+
+    for (size_t i = 0; i < (size_t)counter::count; i++) {
+        std::snprintf(line, sizeof(line), "# HELP cem_tool_%s_total %s\n# TYPE cem_tool_%s_total counter\ncem_tool_%s_total %llu\n",
+                      counter_names[i][0], counter_names[i][1], counter_names[i][0], counter_names[i][0], (unsigned long long)value((counter)i));
+        ret += line;
+    }
+
+    ret += "# HELP cem_tool_stage_duration_seconds Time spent in each processing stage.\n"
+           "# TYPE cem_tool_stage_duration_seconds summary\n";
+
+    for (size_t i = 0; i < (size_t)stage::count; i++) {
+        auto &&h = latencies[i];
+
+        for (auto &&q : {0.5, 0.9, 0.99}) {
+            std::snprintf(line, sizeof(line), "cem_tool_stage_duration_seconds{stage=\"%s\",quantile=\"%g\"} %.6f\n", stage_names[i], q, h.percentile(q) / 1e6);
+            ret += line;
+        }
+
+        std::snprintf(line, sizeof(line), "cem_tool_stage_duration_seconds_sum{stage=\"%s\"} %.6f\ncem_tool_stage_duration_seconds_count{stage=\"%s\"} %llu\n",
+                      stage_names[i], h.sum() / 1e6, stage_names[i], (unsigned long long)h.count());
+        ret += line;
+    }
+
+    return ret;
+}
+
+std::string metrics::json_summary(double elapsed_seconds) {
+    nlohmann::ordered_json j;
+    j["elapsed_seconds"] = elapsed_seconds;
+    j["archives_per_second"] = elapsed_seconds > 0 ? value(counter::archives_processed) / elapsed_seconds : 0.0;
+    j["peak_rss_bytes"] = peak_rss();
+
+    for (size_t i = 0; i < (size_t)counter::count; i++) {
+        j["counters"][counter_names[i][0]] = value((counter)i);
+    }
+
+    for (size_t i = 0; i < (size_t)stage::count; i++) {
+        auto &&h = latencies[i];
+
+        j["stages"][stage_names[i]] = {
+            {"count", h.count()},
+            {"mean_ms", h.count() ? h.sum() / 1e3 / h.count() : 0.0},
+            {"p50_ms", h.percentile(0.5) / 1e3},
+            {"p90_ms", h.percentile(0.9) / 1e3},
+            {"p99_ms", h.percentile(0.99) / 1e3},
+            {"max_ms", h.max() / 1e3},
+        };
+    }
+
+    return j.dump(1, '\t');
+}
+
+
+
+// Written next to the file and renamed over it, scrapers never see half written file.
+static void write_file(const std::filesystem::path& file_path, const std::string& text) {
+    auto temp_path = file_path;
+    temp_path += ".tmp";
+
+    {
+        std::ofstream output(temp_path, std::ios::binary);
+        output << text;
+
+        if(!output) {
+            throw create_except<std::runtime_error>("Failed to write '%s'.", temp_path.string().c_str());
+        }
+    }
+
+    std::filesystem::rename(temp_path, file_path);
+}
+
+metrics::exporter::exporter(const std::filesystem::path& file_path, std::chrono::milliseconds interval) : file_path(file_path) {
+    enabled.store(true, std::memory_order_relaxed);
+    start_time = std::chrono::steady_clock::now();
+
+    thread = std::thread([this, interval]() {
+        std::unique_lock lock(mutex);
+
+        while(!stop_condition.wait_for(lock, interval, [this]() { return stop; })) {
+            write_prometheus();
+        }
+    });
+}
+
+metrics::exporter::~exporter() {
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    stop_condition.notify_one();
+    thread.join();
+
+    write_prometheus();
+
+    try {
+        auto summary_path = file_path;
+        summary_path += ".summary.json";
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+        write_file(summary_path, json_summary(elapsed.count()));
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+void metrics::exporter::write_prometheus() {
+    try {
+        write_file(file_path, prometheus_text());
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Counters and latency histograms for long running jobs.
+// Everything is a no-op until enabled is set. Threads read it relaxed, it may be set while they already run.
+
+
+
+namespace metrics {
+    extern std::atomic<bool> enabled;
+
+    enum class counter {
+        archives_processed,
+        archives_failed,
+        bytes_read,             // Compressed bytes read from zip files
+        bytes_inflated,         // Bytes after decompression
+        probe_successes,
+        probe_failures,
+        probe_timeouts,
+        cache_hits,             // Work skipped because input didnt change
+        cache_misses,
+        count
+    };
+
+    enum class stage {
+        open,                   // Open zip file or its prefetched central directory
+        list,
+        sanity_check,
+        extract,
+        probe,                  // All editor mfx variants of one zip file
+        write,                  // Manifest, catalog or index output
+        archive,                // Whole zip file, end to end
+        count
+    };
+
+    // Log-linear buckets (like HdrHistogram): 16 sub buckets per power of two, under 6.25% error.
+    // Lock free, values are microseconds.
+    class histogram {
+    public:
+        void record(std::uint64_t value);
+
+        std::uint64_t count() const;
+        std::uint64_t sum() const;
+        std::uint64_t max() const;
+        std::uint64_t percentile(double quantile) const;
+
+    private:
+        static constexpr unsigned sub_bucket_bits = 4;
+        static constexpr unsigned sub_bucket_count = 1 << sub_bucket_bits;
+        static constexpr unsigned bucket_count = (64 - sub_bucket_bits + 1) * sub_bucket_count;
+
+        static unsigned bucket_index(std::uint64_t value);
+        static std::uint64_t bucket_upper_bound(unsigned index);
+
+        std::atomic<std::uint64_t> buckets[bucket_count] = {};
+        std::atomic<std::uint64_t> total_count = 0;
+        std::atomic<std::uint64_t> total_sum = 0;
+        std::atomic<std::uint64_t> max_value = 0;
+    };
+
+    // Stage time sums in microseconds for the current thread to add to, recorded even while disabled.
+    // Set on its worker threads by concurrency_controller, which needs stage times to decide.
+    extern thread_local std::atomic<std::uint64_t>* stage_sums;
+
+    void add_enabled(counter c, std::uint64_t value);
+    void record_enabled(stage s, std::chrono::steady_clock::duration duration);
+
+    inline void add(counter c, std::uint64_t value = 1) {
+        if(enabled.load(std::memory_order_relaxed)) {
+            add_enabled(c, value);
+        }
+    }
+
+    inline void record(stage s, std::chrono::steady_clock::duration duration) {
+        if(enabled.load(std::memory_order_relaxed)) {
+            record_enabled(s, duration);
+        }
+    }
+
+    // Records time from construction to destruction.
+    class stage_timer {
+    public:
+        stage_timer(stage s) : s(s), latency(enabled.load(std::memory_order_relaxed)) {
+            if(latency || stage_sums) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~stage_timer() {
+            if(latency || stage_sums) {
+                auto duration = std::chrono::steady_clock::now() - start;
+                if(latency) {
+                    record_enabled(s, duration);
+                }
+                if(stage_sums) {
+                    stage_sums[(size_t)s].fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        stage s;
+        bool latency;           // Enabled when started, start is only set then
+        std::chrono::steady_clock::time_point start;
+    };
+
+    std::uint64_t value(counter c);
+    const histogram& latency(stage s);
+
+    // Peak resident memory of this process in bytes.
+    std::uint64_t peak_rss();
+
+    std::string prometheus_text();
+    std::string json_summary(double elapsed_seconds);
+
+    // Enables metrics and rewrites file in prometheus text format every interval on a background thread.
+    // On destruction writes it one last time and a json summary next to it (<file>.summary.json).
+    class exporter {
+    public:
+        exporter(const std::filesystem::path& file_path, std::chrono::milliseconds interval);
+        exporter(const exporter&) = delete;
+        exporter& operator=(const exporter&) = delete;
+        ~exporter();
+
+    private:
+        std::filesystem::path file_path;
+        std::chrono::steady_clock::time_point start_time;
+
+        std::mutex mutex;
+        std::condition_variable stop_condition;
+        bool stop = false;
+        std::thread thread;
+
+        void write_prometheus();
+    };
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+#include "minhash.hpp"
+
+
+
+
+// splitmix64 finalizer, good enough to act as independent hash functions with different seeds.
+static std::uint64_t mix(std::uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+minhash_signature minhash(const std::vector<std::uint64_t>& features) {
+    minhash_signature signature;
+    signature.fill(UINT64_MAX);
+
+    for (auto &&f : features) {
+        for (size_t i = 0; i < minhash_size; i++) {
+            signature[i] = std::min(signature[i], mix(f ^ mix(i)));
+        }
+    }
+
+    return signature;
+}
+
+double minhash_similarity(const minhash_signature& a, const minhash_signature& b) {
+    size_t same = 0;
+    for (size_t i = 0; i < minhash_size; i++) {
+        same += a[i] == b[i];
+    }
+    return static_cast<double>(same) / minhash_size;
+}
+
+
+namespace {
+    class union_find {
+    public:
+        union_find(size_t size) : parents(size) {
+            std::iota(parents.begin(), parents.end(), 0);
+        }
+
+        size_t find(size_t i) {
+            while(parents[i] != i) {
+                parents[i] = parents[parents[i]];       // path halving
+                i = parents[i];
+            }
+            return i;
+        }
+
+        void join(size_t a, size_t b) {
+            a = find(a);
+            b = find(b);
+            parents[std::max(a, b)] = std::min(a, b);
+        }
+
+    private:
+        std::vector<size_t> parents;
+    };
+}
+
+std::vector<std::vector<size_t>> minhash_clusters(const std::vector<minhash_signature>& signatures, double threshold) {
+    constexpr size_t rows = minhash_size / minhash_bands;
+    union_find groups(signatures.size());
+    std::vector<bool> clustered(signatures.size());
+
+    for (size_t band = 0; band < minhash_bands; band++) {
+        // Band hash to signatures that have it.
+        std::unordered_map<std::uint64_t, std::vector<size_t>> buckets;
+
+        for (size_t i = 0; i < signatures.size(); i++) {
+            std::uint64_t h = band;
+            for (size_t r = 0; r < rows; r++) {
+                h = mix(h ^ signatures[i][band * rows + r]);
+            }
+            buckets[h].push_back(i);
+        }
+
+        for (auto &&[h, members] : buckets) {
+            for (size_t a = 0; a < members.size(); a++) {
+                for (size_t b = a + 1; b < members.size(); b++) {
+                    if(groups.find(members[a]) == groups.find(members[b])) {
+                        continue;
+                    }
+
+                    if(minhash_similarity(signatures[members[a]], signatures[members[b]]) >= threshold) {
+                        groups.join(members[a], members[b]);
+                        clustered[members[a]] = clustered[members[b]] = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // Group index is its smallest member, so groups come out sorted.
+    std::unordered_map<size_t, size_t> group_indices;
+    std::vector<std::vector<size_t>> clusters;
+
+    for (size_t i = 0; i < signatures.size(); i++) {
+        if(!clustered[i]) {
+            continue;
+        }
+
+        auto [it, added] = group_indices.emplace(groups.find(i), clusters.size());
+        if(added) {
+            clusters.emplace_back();
+        }
+        clusters[it->second].push_back(i);
+    }
+
+    return clusters;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+// MinHash signatures of sets of 64bit features, fraction of equal values estimates jaccard similarity of the sets.
+// Clusters are found with LSH banding (only signatures sharing a band are compared) joined by union find,
+// so thousands of signatures dont need all pairs compared.
+
+
+
+static constexpr size_t minhash_size = 128;
+static constexpr size_t minhash_bands = 32;        // minhash_size / minhash_bands rows per band
+
+using minhash_signature = std::array<std::uint64_t, minhash_size>;
+
+
+minhash_signature minhash(const std::vector<std::uint64_t>& features);
+double minhash_similarity(const minhash_signature& a, const minhash_signature& b);
+
+// Groups of signature indices with estimated similarity >= threshold to another one in the group.
+// Signatures without any similar one are left out, groups and indices in them are sorted.
+std::vector<std::vector<size_t>> minhash_clusters(const std::vector<minhash_signature>& signatures, double threshold);
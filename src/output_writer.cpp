@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include "output_writer.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+
+#ifdef _WIN32
+static unsigned long process_id() {
+    return GetCurrentProcessId();
+}
+
+static bool write_all(const std::filesystem::path& file_path, std::string_view data) {
+    HANDLE file = CreateFileW(file_path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool ok = true;
+    while(ok && !data.empty()) {
+        DWORD written = 0;
+        ok = WriteFile(file, data.data(), static_cast<DWORD>(std::min<size_t>(data.size(), 1 << 30)), &written, nullptr) && written;
+        data.remove_prefix(written);
+    }
+
+    // Data has to be on disk before the rename is, or a crash can leave an empty file under the real name.
+    ok = ok && FlushFileBuffers(file);
+    return CloseHandle(file) && ok;
+}
+
+// Write through flushes the rename itself, there is no directory handle to sync.
+static bool replace_file(const std::filesystem::path& temp_path, const std::filesystem::path& file_path) {
+    return MoveFileExW(temp_path.c_str(), file_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+static bool sync_directory(const std::filesystem::path&) {
+    return true;
+}
+#else
+static unsigned long process_id() {
+    return static_cast<unsigned long>(getpid());
+}
+
+static bool write_all(const std::filesystem::path& file_path, std::string_view data) {
+    int fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    while(ok && !data.empty()) {
+        ssize_t written = ::write(fd, data.data(), data.size());
+        ok = written > 0 || (written < 0 && errno == EINTR);    // 0 would never make progress
+        if(written > 0) {
+            data.remove_prefix(written);
+        }
+    }
+
+    // Data has to be on disk before the rename is, or a crash can leave an empty file under the real name.
+    ok = ok && ::fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+}
+
+static bool replace_file(const std::filesystem::path& temp_path, const std::filesystem::path& file_path) {
+    return ::rename(temp_path.c_str(), file_path.c_str()) == 0;
+}
+
+static bool sync_directory(const std::filesystem::path& directory) {
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+
+    bool ok = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+}
+#endif
+
+
+static bool has_content(const std::filesystem::path& file_path, std::string_view data) {
+    std::error_code ec;
+    if(std::filesystem::file_size(file_path, ec) != data.size() || ec) {
+        return false;
+    }
+
+    std::ifstream file(file_path, std::ios::binary);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return !file.bad() && content == data;
+}
+
+
+
+output_writer::output_writer(const std::filesystem::path& directory) : directory(std::filesystem::absolute(directory)) {
+
+}
+
+output_writer::~output_writer() {
+    try {
+        commit();
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+    }
+}
+
+
+std::filesystem::path output_writer::resolve(const std::filesystem::path& file_path) const {
+    return (directory / file_path).lexically_normal();
+}
+
+bool output_writer::write(const std::filesystem::path& file_path, std::string_view data) {
+    auto full_path = resolve(file_path);
+    auto temp_path = full_path;
+
+    // Called with mutex held.
+    auto release = [&]() {
+        claimed.erase(full_path);
+        claim_released.notify_all();
+    };
+
+    {
+        std::unique_lock lock(mutex);
+
+        // One writer per path, others can compare and write their files meanwhile.
+        claim_released.wait(lock, [&]() {
+            return !claimed.contains(full_path);
+        });
+        claimed.insert(full_path);
+
+        // Comparing with the file on disk only works if no older content is still waiting to replace it.
+        for (auto &&p : pending) {
+            if(p.file_path == full_path) {
+                try {
+                    commit_locked();
+                }
+                catch(...) {
+                    release();
+                    throw;
+                }
+                break;
+            }
+        }
+
+        temp_path += ".tmp-" + std::to_string(process_id()) + "-" + std::to_string(temp_counter++);
+    }
+
+    bool changed;
+    bool written = true;
+
+    try {
+        changed = !has_content(full_path, data);
+        if(changed) {
+            std::filesystem::create_directories(full_path.parent_path());
+            written = write_all(temp_path, data);
+        }
+    }
+    catch(...) {
+        std::lock_guard lock(mutex);
+        release();
+        throw;
+    }
+
+    std::lock_guard lock(mutex);
+    release();
+
+    if(!written) {
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        throw create_except<std::runtime_error>("Failed to write '%s'.", temp_path.string().c_str());
+    }
+
+    if(!changed) {
+        unchanged_count++;
+        return false;
+    }
+
+    pending.push_back({temp_path, full_path});
+    written_count++;
+
+    if(pending.size() >= batch_size) {
+        commit_locked();
+    }
+
+    return true;
+}
+
+bool output_writer::write(const std::filesystem::path& file_path, const std::vector<std::uint8_t>& data) {
+    return write(file_path, std::string_view(reinterpret_cast<const char*>(data.data()), data.size()));
+}
+
+void output_writer::commit() {
+    std::lock_guard lock(mutex);
+    commit_locked();
+}
+
+std::size_t output_writer::written() {
+    std::lock_guard lock(mutex);
+    return written_count;
+}
+
+std::size_t output_writer::unchanged() {
+    std::lock_guard lock(mutex);
+    return unchanged_count;
+}
+
+
+// Called with mutex held.
+void output_writer::commit_locked() {
+    auto files = std::move(pending);
+    pending.clear();
+
+    std::set<std::filesystem::path> directories;
+    std::string error;
+
+    // Temp files were synced by write_all.
+    for (auto &&f : files) {
+        if(!error.empty() || !replace_file(f.temp_path, f.file_path)) {
+            if(error.empty()) {
+                error = f.file_path.string();
+            }
+            std::error_code ec;
+            std::filesystem::remove(f.temp_path, ec);
+            continue;
+        }
+        directories.insert(f.file_path.parent_path());
+    }
+
+    for (auto &&d : directories) {
+        if(!sync_directory(d) && error.empty()) {
+            error = d.string();
+        }
+    }
+
+    if(!error.empty()) {
+        throw create_except<std::runtime_error>("Failed to write '%s'.", error.c_str());
+    }
+}
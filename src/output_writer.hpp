@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Writes manifests, catalogs and indexes without leaving half written files behind.
+// Every file is written in one go to a temp file next to it and synced, temp files are renamed over their
+// targets in batches, then each touched directory is synced once per batch.
+// Comparing and writing happens outside the lock, only one writer at a time per path.
+// Files that already have the same content are not touched at all, reruns over the same zip files only read.
+
+
+
+class output_writer {
+public:
+    // Relative paths are written to directory.
+    output_writer(const std::filesystem::path& directory);
+    output_writer(const output_writer&) = delete;
+    output_writer& operator=(const output_writer&) = delete;
+    ~output_writer();
+
+    // Full path file_path is written to.
+    std::filesystem::path resolve(const std::filesystem::path& file_path) const;
+
+    // Returns false if the file already has this content and was left alone.
+    // File shows up once committed, at latest when batch_size files are pending.
+    bool write(const std::filesystem::path& file_path, std::string_view data);
+    bool write(const std::filesystem::path& file_path, const std::vector<std::uint8_t>& data);
+
+    // Renames all pending temp files over their targets.
+    void commit();
+
+    std::size_t written();
+    std::size_t unchanged();
+
+private:
+    static constexpr std::size_t batch_size = 256;
+
+    struct pending_file {
+        std::filesystem::path temp_path;
+        std::filesystem::path file_path;
+    };
+
+    std::filesystem::path directory;
+    std::mutex mutex;
+    std::condition_variable claim_released;
+    std::set<std::filesystem::path> claimed;       // Paths being compared or written right now
+    std::vector<pending_file> pending;
+    std::size_t temp_counter = 0;
+    std::size_t written_count = 0;
+    std::size_t unchanged_count = 0;
+
+    void commit_locked();
+};
@@ -0,0 +1,59 @@
+#include <algorithm>
+#include <cstring>
+
+#include "path_table.hpp"
+
+
+
+path_table::path_table(const path_table& other) {
+    *this = other;
+}
+
+path_table& path_table::operator=(const path_table& other) {
+    if(this == &other) {
+        return *this;
+    }
+
+    // Views point into the other arena, add everything again.
+    *this = path_table();
+    paths.reserve(other.size());
+
+    for (auto &&p : other) {
+        push_back(p);
+    }
+
+    return *this;
+}
+
+
+std::string_view path_table::push_back(std::string_view path) {
+    auto interned = intern(path);
+    paths.push_back(interned);
+    return interned;
+}
+
+
+std::string_view path_table::intern(std::string_view str) {
+    if(str.empty()) {
+        return {};
+    }
+
+    // Paths longer than a block get a block of their own.
+    if(blocks.empty() || str.size() > block_size - block_used) {
+        size_t size = std::max(block_size, str.size());
+        blocks.push_back(std::make_unique<char[]>(size));
+        block_used = 0;
+
+        if(size > block_size) {
+            std::memcpy(blocks.back().get(), str.data(), str.size());
+            block_used = block_size;
+            return {blocks.back().get(), str.size()};
+        }
+    }
+
+    char* dest = blocks.back().get() + block_used;
+    std::memcpy(dest, str.data(), str.size());
+    block_used += str.size();
+
+    return {dest, str.size()};
+}
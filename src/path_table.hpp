@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Zip entry paths interned in an arena.
+// Every path is one contiguous string_view that stays valid while the table lives (also after a move).
+
+
+
+class path_table {
+public:
+    using const_iterator = std::vector<std::string_view>::const_iterator;
+
+    path_table() = default;
+    path_table(const path_table& other);
+    path_table(path_table&& other) noexcept = default;
+    path_table& operator=(const path_table& other);
+    path_table& operator=(path_table&& other) noexcept = default;
+
+    // Returns the interned path.
+    std::string_view push_back(std::string_view path);
+
+    size_t size() const { return paths.size(); }
+    bool empty() const { return paths.empty(); }
+    std::string_view operator[](size_t index) const { return paths[index]; }
+    const_iterator begin() const { return paths.begin(); }
+    const_iterator end() const { return paths.end(); }
+
+private:
+    static constexpr size_t block_size = 4096;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t block_used = block_size;                 // Of the last block, full means allocate next one
+
+    std::vector<std::string_view> paths;
+
+    std::string_view intern(std::string_view str);
+};
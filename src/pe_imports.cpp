@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cctype>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include "pe_imports.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+
+
+
+// Little endian, like everything in PE files.
+static std::uint32_t read_u16(const std::vector<std::uint8_t>& image, std::uint64_t offset) {
+    if(offset + 2 > image.size()) {
+        throw std::runtime_error("Bad PE file: Truncated.");
+    }
+    return image[offset] | image[offset + 1] << 8;
+}
+
+static std::uint32_t read_u32(const std::vector<std::uint8_t>& image, std::uint64_t offset) {
+    return read_u16(image, offset) | read_u16(image, offset + 2) << 16;
+}
+
+
+struct pe_section {
+    std::uint32_t virtual_address;
+    std::uint32_t virtual_size;
+    std::uint32_t raw_offset;
+    std::uint32_t raw_size;
+};
+
+static std::uint64_t rva_to_offset(const std::vector<pe_section>& sections, std::uint32_t size_of_headers, std::uint32_t rva) {
+    for (auto &&s : sections) {
+        auto size = std::max(s.virtual_size, s.raw_size);
+        if(rva >= s.virtual_address && rva - s.virtual_address < size) {
+            return static_cast<std::uint64_t>(rva - s.virtual_address) + s.raw_offset;
+        }
+    }
+
+    if(rva < size_of_headers) {
+        return rva;
+    }
+
+    throw create_except("Bad PE file: Address 0x%08x is not in any section.", rva);
+}
+
+std::vector<std::string> pe_imported_dlls(const std::vector<std::uint8_t>& image) {
+    if(read_u16(image, 0) != 0x5a4d) {          // MZ
+        throw std::runtime_error("Not a PE file: No MZ header.");
+    }
+
+    std::uint64_t pe_header = read_u32(image, 0x3c);
+    if(read_u32(image, pe_header) != 0x00004550) {     // PE\0\0
+        throw std::runtime_error("Not a PE file: No PE header.");
+    }
+
+    std::uint32_t section_count = read_u16(image, pe_header + 6);
+    std::uint32_t optional_header_size = read_u16(image, pe_header + 20);
+    std::uint64_t optional_header = pe_header + 24;
+
+    // Data directories are at a different place in PE32 (32bit) and PE32+ (64bit).
+    std::uint64_t data_directories;
+    std::uint32_t data_directory_count;
+
+    switch (read_u16(image, optional_header)) {
+    case 0x10b:
+        data_directory_count = read_u32(image, optional_header + 92);
+        data_directories = optional_header + 96;
+        break;
+    case 0x20b:
+        data_directory_count = read_u32(image, optional_header + 108);
+        data_directories = optional_header + 112;
+        break;
+    default:
+        throw std::runtime_error("Bad PE file: Unknown optional header.");
+    }
+
+    std::uint32_t size_of_headers = read_u32(image, optional_header + 60);
+
+    std::vector<pe_section> sections;
+    std::uint64_t section_table = optional_header + optional_header_size;
+    for (std::uint32_t i = 0; i < section_count; i++) {
+        auto s = section_table + i * 40;
+        sections.push_back({read_u32(image, s + 12), read_u32(image, s + 8), read_u32(image, s + 20), read_u32(image, s + 16)});
+    }
+
+    std::vector<std::string> dlls;
+
+    // Import directory is entry 1.
+    if(data_directory_count < 2 || read_u32(image, data_directories + 8) == 0) {
+        return dlls;
+    }
+
+    auto descriptor = rva_to_offset(sections, size_of_headers, read_u32(image, data_directories + 8));
+
+    // Import descriptors end with an all zero one, dont trust that too much.
+    for (size_t i = 0; i < 4096; i++, descriptor += 20) {
+        std::uint32_t name_rva = read_u32(image, descriptor + 12);
+        if(name_rva == 0 && read_u32(image, descriptor) == 0 && read_u32(image, descriptor + 16) == 0) {
+            return dlls;
+        }
+
+        auto name = rva_to_offset(sections, size_of_headers, name_rva);
+        auto end = std::find(image.begin() + std::min<std::uint64_t>(name, image.size()), image.end(), 0);
+        if(end == image.end()) {
+            throw std::runtime_error("Bad PE file: Unterminated import name.");
+        }
+
+        dlls.emplace_back(image.begin() + name, end);
+    }
+
+    throw std::runtime_error("Bad PE file: Too many imported dlls.");
+}
+
+
+const char* import_kind_name(import_kind kind) {
+    switch (kind) {
+    case import_kind::bundled: return "bundled";
+    case import_kind::system: return "system";
+    case import_kind::mmfs2: return "mmfs2";
+    case import_kind::missing: return "missing";
+    }
+    return "?";
+}
+
+
+// Dll names are not case sensitive on windows.
+static std::string lower(std::string_view str) {
+    std::string ret(str);
+    for (auto &&c : ret) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return ret;
+}
+
+bool is_system_dll(std::string_view dll) {
+    auto name = lower(dll);
+
+    // Api sets are resolved by the loader, not real files.
+    if(name.starts_with("api-ms-win-") || name.starts_with("ext-ms-")) {
+        return true;
+    }
+
+    // Visual c++ runtimes are not part of windows, but fusion needs them itself so they are there.
+    if(name.starts_with("msvcr") || name.starts_with("msvcp") || name.starts_with("vcruntime") || name.starts_with("mfc")) {
+        return true;
+    }
+
+    // What extensions import most, enough when not on windows.
+    static const std::set<std::string, std::less<>> known = {
+        "advapi32.dll", "bcrypt.dll", "comctl32.dll", "comdlg32.dll", "crypt32.dll", "d3d9.dll", "d3d11.dll", "d3dx9_43.dll",
+        "dbghelp.dll", "ddraw.dll", "dinput.dll", "dinput8.dll", "dsound.dll", "dwmapi.dll", "dxgi.dll", "gdi32.dll",
+        "gdiplus.dll", "glu32.dll", "hid.dll", "imagehlp.dll", "imm32.dll", "iphlpapi.dll", "kernel32.dll", "msacm32.dll",
+        "msimg32.dll", "msvcrt.dll", "mpr.dll", "netapi32.dll", "ntdll.dll", "ole32.dll", "oleaut32.dll", "oledlg.dll",
+        "opengl32.dll", "psapi.dll", "rpcrt4.dll", "secur32.dll", "setupapi.dll", "shell32.dll", "shlwapi.dll", "ucrtbase.dll",
+        "urlmon.dll", "user32.dll", "userenv.dll", "uxtheme.dll", "version.dll", "winhttp.dll", "wininet.dll", "winmm.dll",
+        "winspool.drv", "wintrust.dll", "wldap32.dll", "ws2_32.dll", "wsock32.dll", "wtsapi32.dll", "xinput1_3.dll", "xinput1_4.dll",
+        "xinput9_1_0.dll",
+    };
+
+    if(known.contains(name)) {
+        return true;
+    }
+
+#ifdef _WIN32
+    // 32bit processes see SysWOW64 here, same as the loader.
+    wchar_t system_directory[MAX_PATH];
+    auto length = GetSystemDirectoryW(system_directory, MAX_PATH);
+    if(length > 0 && length < MAX_PATH) {
+        std::error_code error;
+        return std::filesystem::exists(std::filesystem::path(std::wstring(system_directory, length)) / to_utf16(dll), error);
+    }
+#endif
+
+    return false;
+}
+
+
+// Closest one wins: same directory as the importer, then Extensions/, then anywhere in the zip file.
+static std::string find_bundled(const std::multimap<std::string, std::string>& by_name, const std::string& dll, const std::string& imported_by) {
+    auto directory = imported_by.substr(0, imported_by.rfind('/') + 1);
+    auto [begin, end] = by_name.equal_range(lower(dll));
+
+    std::string found;
+    int found_rank = 3;
+
+    for (auto it = begin; it != end; it++) {
+        auto &&path = it->second;
+        int rank = path.substr(0, path.rfind('/') + 1) == directory ? 0 : path.starts_with("Extensions/") ? 1 : 2;
+
+        if(rank < found_rank) {
+            found = path;
+            found_rank = rank;
+        }
+    }
+
+    return found;
+}
+
+std::vector<pe_import> resolve_imports(const std::string& mfx_path, const path_table& files, const std::function<std::vector<std::uint8_t>(const std::string& path)>& read_file) {
+    std::multimap<std::string, std::string> by_name;     // Lower case file name, path
+    for (auto &&f : files) {
+        auto name = f.substr(f.rfind('/') + 1);
+        if(lower(name).ends_with(".dll")) {
+            by_name.emplace(lower(name), std::string(f));
+        }
+    }
+
+    std::vector<pe_import> imports;
+    std::set<std::string> seen;                 // Lower case dll names
+    std::deque<std::string> pending = {mfx_path};
+
+    while(!pending.empty()) {
+        auto importer = pending.front();
+        pending.pop_front();
+
+        std::vector<std::string> dlls;
+        try {
+            dlls = pe_imported_dlls(read_file(importer));
+        }
+        catch(const std::exception& e) {
+            throw create_except("Failed to read imports of '%s': %s", importer.c_str(), e.what());
+        }
+
+        for (auto &&dll : dlls) {
+            if(!seen.insert(lower(dll)).second) {
+                continue;
+            }
+
+            pe_import i = {dll, import_kind::missing, "", importer};
+
+            // Bundled copy wins, thats what fusion would load from the extension directory.
+            i.bundled_path = find_bundled(by_name, dll, importer);
+
+            if(!i.bundled_path.empty()) {
+                i.kind = import_kind::bundled;
+                pending.push_back(i.bundled_path);
+            } else if(lower(dll) == "mmfs2.dll") {
+                i.kind = import_kind::mmfs2;
+            } else if(is_system_dll(dll)) {
+                i.kind = import_kind::system;
+            }
+
+            imports.push_back(std::move(i));
+        }
+    }
+
+    return imports;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "path_table.hpp"
+
+// Static import table walker for editor mfx files, finds which dlls an extension needs
+// without loading it, so only those get staged and missing ones are reported up front.
+// Plain file parsing, works the same on every platform.
+
+
+
+// Dll names from the import directory of a PE32 or PE32+ image, as written in the file.
+// Delay loaded dlls are left out, they dont have to exist for LoadLibrary to succeed.
+std::vector<std::string> pe_imported_dlls(const std::vector<std::uint8_t>& image);
+
+
+enum class import_kind {
+    bundled,        // In the zip file, staged next to the mfx
+    system,         // Comes with windows (or visual c++ runtime)
+    mmfs2,          // Fusion runtime, copied next to cem-tool
+    missing,
+};
+
+const char* import_kind_name(import_kind kind);
+
+
+struct pe_import {
+    std::string dll;                // As imported
+    import_kind kind;
+    std::string bundled_path;       // Path in zip file if bundled
+    std::string imported_by;        // Path in zip file of mfx or bundled dll that imports it
+};
+
+
+// Imports of mfx and of every bundled dll it needs, each dll once in order they are found.
+// read_file gets a path from files and returns its content.
+std::vector<pe_import> resolve_imports(const std::string& mfx_path, const path_table& files, const std::function<std::vector<std::uint8_t>(const std::string& path)>& read_file);
+
+bool is_system_dll(std::string_view dll);
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "precompress.hpp"
+#include "string_helper.hpp"
+
+#include "zlib.h"
+
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+
+
+
+
+// Big enough that splitting costs almost nothing in compressed size.
+static constexpr size_t chunk_size = 1 << 21;
+
+// Served as is for a long time, worth the slowest settings.
+static constexpr int gzip_level = 9;
+static constexpr int zstd_level = 19;
+
+
+struct compressed_chunk {
+    std::vector<std::uint8_t> data;
+    std::uint32_t crc = 0;          // gzip only
+};
+
+// Every worker picks chunks in order from a shared counter.
+static std::vector<compressed_chunk> compress_chunks(std::string_view data, unsigned jobs, const std::function<void(compressed_chunk* chunk, std::string_view input, bool last)>& compress) {
+    std::vector<compressed_chunk> chunks(std::max<size_t>((data.size() + chunk_size - 1) / chunk_size, 1));
+    std::atomic<size_t> next_chunk = 0;
+    unsigned worker_count = static_cast<unsigned>(std::min<size_t>(std::max(jobs, 1u), chunks.size()));
+    std::vector<std::string> errors(worker_count);
+    std::vector<std::thread> workers;
+
+    for (unsigned w = 0; w < worker_count; w++) {
+        workers.emplace_back([&, w]() {
+            try {
+                for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+                    compress(&chunks[i], data.substr(std::min(i * chunk_size, data.size()), chunk_size), i + 1 == chunks.size());
+                }
+            }
+            catch(const std::exception& e) {
+                errors[w] = e.what();
+                next_chunk = chunks.size();
+            }
+        });
+    }
+
+    for (auto &&t : workers) {
+        t.join();
+    }
+
+    for (auto &&e : errors) {
+        if(!e.empty()) {
+            throw std::runtime_error(e);
+        }
+    }
+
+    return chunks;
+}
+
+
+// Raw deflate, every chunk but the last ends with a sync flush so they can be simply appended.
+static void deflate_chunk(compressed_chunk* chunk, std::string_view input, bool last) {
+    auto bytes = reinterpret_cast<const Bytef*>(input.data());
+    chunk->crc = crc32(crc32(0, nullptr, 0), bytes, static_cast<uInt>(input.size()));
+
+    z_stream stream = {};
+    if(deflateInit2(&stream, gzip_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to gzip: deflateInit2 failed.");
+    }
+
+    chunk->data.resize(deflateBound(&stream, static_cast<uLong>(input.size())) + 16);     // + sync flush marker
+    stream.next_in = const_cast<Bytef*>(bytes);
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = chunk->data.data();
+    stream.avail_out = static_cast<uInt>(chunk->data.size());
+
+    int status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    chunk->data.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if(status != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0) {
+        throw create_except("Failed to gzip: deflate failed (%d).", status);
+    }
+}
+
+static std::vector<std::uint8_t> gzip(std::string_view data, unsigned jobs) {
+    auto chunks = compress_chunks(data, jobs, deflate_chunk);
+
+    // No name and no time, same input gives same file.
+    std::vector<std::uint8_t> ret = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 255};
+
+    std::uint32_t crc = crc32(0, nullptr, 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        auto length = std::min(chunk_size, data.size() - std::min(i * chunk_size, data.size()));
+        crc = crc32_combine(crc, chunks[i].crc, static_cast<z_off_t>(length));
+        ret.insert(ret.end(), chunks[i].data.begin(), chunks[i].data.end());
+    }
+
+    std::uint32_t size = static_cast<std::uint32_t>(data.size());       // Modulo 2^32
+    for (auto &&v : {crc, size}) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            ret.push_back(static_cast<std::uint8_t>(v >> shift));
+        }
+    }
+
+    return ret;
+}
+
+
+#ifdef HAVE_ZSTD
+static void zstd_chunk(compressed_chunk* chunk, std::string_view input, bool last) {
+    chunk->data.resize(ZSTD_compressBound(input.size()));
+
+    auto size = ZSTD_compress(chunk->data.data(), chunk->data.size(), input.data(), input.size(), zstd_level);
+    if(ZSTD_isError(size)) {
+        throw create_except("Failed to zstd compress: %s.", ZSTD_getErrorName(size));
+    }
+
+    chunk->data.resize(size);
+}
+
+static std::vector<std::uint8_t> zstd(std::string_view data, unsigned jobs) {
+    std::vector<std::uint8_t> ret;
+    for (auto &&c : compress_chunks(data, jobs, zstd_chunk)) {
+        ret.insert(ret.end(), c.data.begin(), c.data.end());
+    }
+    return ret;
+}
+#endif
+
+
+bool precompress_supported(precompress_format format) {
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return format != precompress_format::zstd;
+#endif
+}
+
+const char* precompress_extension(precompress_format format) {
+    return format == precompress_format::gzip ? ".gz" : ".zst";
+}
+
+std::vector<std::uint8_t> precompress(std::string_view data, precompress_format format, unsigned jobs) {
+    switch (format) {
+    case precompress_format::gzip:
+        return gzip(data, jobs);
+#ifdef HAVE_ZSTD
+    case precompress_format::zstd:
+        return zstd(data, jobs);
+#endif
+    default:
+        throw std::logic_error("Compression format not supported by this build.");
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Gzip and zstd copies of generated json files, so they can be served pre-compressed.
+// Data is split in chunks compressed in parallel: gzip chunks are joined in to one deflate stream
+// (like pigz does), zstd chunks are separate frames. Any decoder reads both as one file.
+
+
+
+enum class precompress_format {
+    gzip,
+    zstd,           // Only if built with libzstd (HAVE_ZSTD)
+};
+
+bool precompress_supported(precompress_format format);
+
+// File extension added to the original file name, with the dot.
+const char* precompress_extension(precompress_format format);
+
+std::vector<std::uint8_t> precompress(std::string_view data, precompress_format format, unsigned jobs);
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "process.hpp"
+#include "string_helper.hpp"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+#ifndef __linux__
+static std::mutex spawn_mutex;      // Pipe creation and spawns, see run_process()
+#endif
+#endif
+
+
+
+#ifdef _WIN32
+// CommandLineToArgvW rules, backslashes are only special before quotes.
+static std::wstring quote_arg(const std::string& arg) {
+    std::wstring warg = to_utf16(arg);
+    std::wstring ret = L"\"";
+    size_t backslashes = 0;
+
+    for (auto &&c : warg) {
+        if(c == L'\\') {
+            backslashes++;
+            continue;
+        }
+
+        if(c == L'"') {
+            ret.append(backslashes * 2 + 1, L'\\');
+        } else {
+            ret.append(backslashes, L'\\');
+        }
+
+        backslashes = 0;
+        ret.push_back(c);
+    }
+
+    ret.append(backslashes * 2, L'\\');
+    ret.push_back(L'"');
+    return ret;
+}
+
+process_result run_process(const std::filesystem::path& executable, const std::vector<std::string>& args, std::chrono::milliseconds timeout) {
+    std::wstring command_line = quote_arg(executable.string());
+    for (auto &&a : args) {
+        command_line += L" " + quote_arg(a);
+    }
+
+    SECURITY_ATTRIBUTES security_attributes = {};
+    security_attributes.nLength = sizeof(security_attributes);
+    security_attributes.bInheritHandle = TRUE;
+
+    HANDLE read_pipe, write_pipe;
+    if(!CreatePipe(&read_pipe, &write_pipe, &security_attributes, 0)) {
+        throw create_except<std::runtime_error>("CreatePipe failed: %s.", last_system_error().c_str());
+    }
+    SetHandleInformation(read_pipe, HANDLE_FLAG_INHERIT, 0);
+
+    STARTUPINFOEXW startup_info = {};
+    startup_info.StartupInfo.cb = sizeof(startup_info);
+    startup_info.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startup_info.StartupInfo.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup_info.StartupInfo.hStdOutput = write_pipe;
+    startup_info.StartupInfo.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+    // Only this pipe and our std handles are inherited, not pipes of probes started at the same time
+    // from other threads. Those would keep our pipe open and the read below wouldnt end with the child.
+    std::vector<HANDLE> inherited = {write_pipe};
+    for (auto &&h : {startup_info.StartupInfo.hStdInput, startup_info.StartupInfo.hStdError}) {
+        DWORD flags = 0;
+        if(h && h != INVALID_HANDLE_VALUE && GetHandleInformation(h, &flags) && (flags & HANDLE_FLAG_INHERIT) && std::find(inherited.begin(), inherited.end(), h) == inherited.end()) {
+            inherited.push_back(h);
+        }
+    }
+
+    SIZE_T attribute_list_size = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &attribute_list_size);
+    std::vector<std::uint8_t> attribute_list(attribute_list_size);
+    startup_info.lpAttributeList = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attribute_list.data());
+
+    if(!InitializeProcThreadAttributeList(startup_info.lpAttributeList, 1, 0, &attribute_list_size) ||
+       !UpdateProcThreadAttribute(startup_info.lpAttributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited.data(), inherited.size() * sizeof(HANDLE), nullptr, nullptr)) {
+        auto error = last_system_error();
+        CloseHandle(read_pipe);
+        CloseHandle(write_pipe);
+        throw create_except<std::runtime_error>("Failed to set inherited handles: %s.", error.c_str());
+    }
+
+    PROCESS_INFORMATION process_info = {};
+    BOOL created = CreateProcessW(nullptr, command_line.data(), nullptr, nullptr, TRUE, EXTENDED_STARTUPINFO_PRESENT, nullptr, nullptr, &startup_info.StartupInfo, &process_info);
+    DeleteProcThreadAttributeList(startup_info.lpAttributeList);
+    CloseHandle(write_pipe);
+
+    if(!created) {
+        auto error = last_system_error();
+        CloseHandle(read_pipe);
+        throw create_except<std::runtime_error>("Failed to start '%s': %s.", executable.string().c_str(), error.c_str());
+    }
+
+    process_result ret = {};
+
+    // Pipe is read on its own thread so the wait below can time out, killing the child ends the read.
+    std::thread reader([&]() {
+        char buf[4096];
+        DWORD read = 0;
+
+        while(ReadFile(read_pipe, buf, sizeof(buf), &read, nullptr) && read) {
+            ret.output.append(buf, read);
+        }
+    });
+
+    DWORD wait_time = timeout.count() ? static_cast<DWORD>(timeout.count()) : INFINITE;
+    if(WaitForSingleObject(process_info.hProcess, wait_time) == WAIT_TIMEOUT) {
+        TerminateProcess(process_info.hProcess, 1);
+        WaitForSingleObject(process_info.hProcess, INFINITE);
+        ret.timed_out = true;
+    }
+
+    reader.join();
+
+    DWORD exit_code = 0;
+    GetExitCodeProcess(process_info.hProcess, &exit_code);
+    ret.exit_code = (int)exit_code;
+
+    CloseHandle(read_pipe);
+    CloseHandle(process_info.hProcess);
+    CloseHandle(process_info.hThread);
+    return ret;
+}
+
+std::filesystem::path current_executable_path() {
+    wchar_t buf[MAX_PATH];
+    DWORD size = GetModuleFileNameW(nullptr, buf, MAX_PATH);
+
+    if(size == 0 || size == MAX_PATH) {
+        throw create_except<std::runtime_error>("GetModuleFileNameW failed: %s.", last_system_error().c_str());
+    }
+
+    return std::filesystem::path(std::wstring(buf, size));
+}
+#else
+process_result run_process(const std::filesystem::path& executable, const std::vector<std::string>& args, std::chrono::milliseconds timeout) {
+    auto executable_str = executable.string();
+
+    std::vector<char*> argv;
+    argv.push_back(executable_str.data());
+    std::vector<std::string> args_copy = args;
+    for (auto &&a : args_copy) {
+        argv.push_back(a.data());
+    }
+    argv.push_back(nullptr);
+
+    // Close on exec, probes started at the same time from other threads must not inherit our pipe.
+    // They would keep it open and the read below wouldnt end with the child. dup2 to stdout clears the flag.
+    int pipe_fds[2];
+#ifdef __linux__
+    if(pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        throw create_except<std::runtime_error>("pipe failed: %s.", last_system_error().c_str());
+    }
+#else
+    {
+        // No pipe2, only spawns are serialized against the window before the flag is set.
+        std::lock_guard lock(spawn_mutex);
+        if(pipe(pipe_fds) != 0) {
+            throw create_except<std::runtime_error>("pipe failed: %s.", last_system_error().c_str());
+        }
+        fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+
+    pid_t pid;
+    int status;
+    {
+#ifndef __linux__
+        std::lock_guard lock(spawn_mutex);
+#endif
+        status = posix_spawn(&pid, executable_str.c_str(), &actions, nullptr, argv.data(), environ);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipe_fds[1]);
+
+    if(status != 0) {
+        close(pipe_fds[0]);
+        errno = status;
+        throw create_except<std::runtime_error>("Failed to start '%s': %s.", executable_str.c_str(), last_system_error().c_str());
+    }
+
+    process_result ret = {};
+    char buf[4096];
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while(true) {
+        int wait_time = -1;
+
+        if(timeout.count()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+            if(left.count() <= 0) {
+                kill(pid, SIGKILL);
+                ret.timed_out = true;
+                break;
+            }
+            wait_time = static_cast<int>(left.count());
+        }
+
+        pollfd poll_fd = {pipe_fds[0], POLLIN, 0};
+        int status = poll(&poll_fd, 1, wait_time);
+
+        if(status == 0 || (status < 0 && errno == EINTR)) {
+            continue;
+        }
+
+        ssize_t read_size = status < 0 ? -1 : read(pipe_fds[0], buf, sizeof(buf));
+
+        if(read_size > 0) {
+            ret.output.append(buf, read_size);
+        } else if(read_size == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    close(pipe_fds[0]);
+
+    int wait_status = 0;
+    while(waitpid(pid, &wait_status, 0) < 0 && errno == EINTR) {}
+
+    ret.exit_code = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -1;
+    return ret;
+}
+
+std::filesystem::path current_executable_path() {
+    return std::filesystem::read_symlink("/proc/self/exe");
+}
+#endif
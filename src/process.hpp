@@ -0,0 +1,22 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <chrono>
+
+// Minimal child process helpers
+
+
+
+struct process_result {
+    int exit_code;
+    std::string output;     // Everything child wrote to stdout, stderr is inherited.
+    bool timed_out;         // Killed after timeout, exit_code is meaningless.
+};
+
+// Runs executable and waits until it exits, or kills it after timeout (0 = no timeout).
+process_result run_process(const std::filesystem::path& executable, const std::vector<std::string>& args, std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+
+// Path to cem-tool executable itself.
+std::filesystem::path current_executable_path();
@@ -3,12 +3,18 @@
 #include <cstdio>           // std::snprintf
 #include <cassert>
 
+#ifdef _WIN32
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#else
+#include <cerrno>
+#include <cstring>
+#endif
 
 
 
+#ifdef _WIN32
 std::string to_utf8(std::wstring_view utf16_str) {
     int buffer_size = WideCharToMultiByte(
         CP_UTF8,
@@ -25,14 +31,14 @@ std::string to_utf8(std::wstring_view utf16_str) {
         return "";
     }
 
-    char* buffer = new char[buffer_size];
+    std::string buffer(buffer_size, 0);
 
     int status = WideCharToMultiByte(
         CP_UTF8,
         0,
         utf16_str.data(),
         utf16_str.size(),
-        buffer,
+        buffer.data(),
         buffer_size,
         nullptr,
         nullptr
@@ -47,7 +53,7 @@ std::string to_utf8(std::wstring_view utf16_str) {
         throw std::runtime_error(error_buf);
     }
 
-    return std::string(buffer, buffer_size);
+    return buffer;
 }
 
 std::wstring to_utf16(std::string_view utf8_str) {
@@ -64,14 +70,14 @@ std::wstring to_utf16(std::string_view utf8_str) {
         return L"";
     }
 
-    wchar_t* buffer = new wchar_t[buffer_size];
+    std::wstring buffer(buffer_size, 0);
 
     int status = MultiByteToWideChar(
         CP_UTF8,
         0,
         utf8_str.data(),
         utf8_str.size(),
-        buffer,
+        buffer.data(),
         buffer_size
     );
 
@@ -84,7 +90,7 @@ std::wstring to_utf16(std::string_view utf8_str) {
         throw std::runtime_error(error_buf);
     }
 
-    return std::wstring(buffer, buffer_size);
+    return buffer;
 }
 
 
@@ -116,9 +122,96 @@ std::string last_system_error() {
     std::snprintf(ret_buf, ret_buf_size, "(%u) %s", last_error, system_error_str.c_str());
     return ret_buf;
 }
+#else
+// wchar_t is utf32 everywhere but windows.
+std::string to_utf8(std::wstring_view utf16_str) {
+    std::string ret;
+    ret.reserve(utf16_str.size());
+
+    for (auto &&wc : utf16_str) {
+        auto c = static_cast<std::uint32_t>(wc);
+
+        if(c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+            throw create_except("UTF32 to UTF8 text conversion failed: Bad code point %u.", c);
+        }
+
+        if(c < 0x80) {
+            ret.push_back(static_cast<char>(c));
+        } else if(c < 0x800) {
+            ret.push_back(static_cast<char>(0xc0 | (c >> 6)));
+            ret.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        } else if(c < 0x10000) {
+            ret.push_back(static_cast<char>(0xe0 | (c >> 12)));
+            ret.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+            ret.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        } else {
+            ret.push_back(static_cast<char>(0xf0 | (c >> 18)));
+            ret.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3f)));
+            ret.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3f)));
+            ret.push_back(static_cast<char>(0x80 | (c & 0x3f)));
+        }
+    }
+
+    return ret;
+}
+
+std::wstring to_utf16(std::string_view utf8_str) {
+    std::wstring ret;
+    ret.reserve(utf8_str.size());
+
+    for (size_t i = 0; i < utf8_str.size(); ) {
+        auto lead = static_cast<std::uint8_t>(utf8_str[i]);
+        size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xe ? 3 : (lead >> 3) == 0x1e ? 4 : 0;
+
+        if(length == 0 || i + length > utf8_str.size()) {
+            throw create_except("UTF8 to UTF32 text conversion failed: Bad byte at %zu.", i);
+        }
+
+        std::uint32_t c = length == 1 ? lead : lead & (0x7f >> length);
+        for (size_t j = 1; j < length; j++) {
+            auto next = static_cast<std::uint8_t>(utf8_str[i + j]);
+
+            if((next & 0xc0) != 0x80) {
+                throw create_except("UTF8 to UTF32 text conversion failed: Bad byte at %zu.", i + j);
+            }
+            c = (c << 6) | (next & 0x3f);
+        }
+
+        ret.push_back(static_cast<wchar_t>(c));
+        i += length;
+    }
+
+    return ret;
+}
+
+
+std::string last_system_error() {
+    int last_error = errno;
+
+    const size_t ret_buf_size = 256;
+    char ret_buf[ret_buf_size];
+
+    std::snprintf(ret_buf, ret_buf_size, "(%d) %s", last_error, std::strerror(last_error));
+    return ret_buf;
+}
+#endif
+
+
+
+std::uint64_t stable_hash(std::string_view str) {
+    std::uint64_t hash = 0xcbf29ce484222325;
+
+    for (auto &&c : str) {
+        hash ^= static_cast<std::uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
 
 
 
+#ifdef _WIN32
 windows_utf8_in_console::windows_utf8_in_console() {
     before_codepage = GetConsoleCP();
     before_out_codepage = GetConsoleOutputCP();
@@ -134,3 +227,8 @@ windows_utf8_in_console::~windows_utf8_in_console() {
         SetConsoleOutputCP(before_out_codepage);
     }
 }
+#else
+// Terminals already use utf8.
+windows_utf8_in_console::windows_utf8_in_console() {}
+windows_utf8_in_console::~windows_utf8_in_console() {}
+#endif
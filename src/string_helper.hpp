@@ -13,26 +13,30 @@ std::wstring to_utf16(std::string_view utf8_str);
 
 
 // Helper function to create fancy exceptions
-template <class T = std::exception>
+template <class T = std::runtime_error>
 T create_except(const char* fmt...) {
-    std::va_list args;
+    std::va_list args, args_copy;
     va_start(args, fmt);
+    va_copy(args_copy, args);       // va_list cant be reused after vsnprintf outside msvc
 
     int buf_size = std::vsnprintf(nullptr, 0, fmt, args) + 1;   // vsnprintf doesnt include null terminator
-    char* buffer = new char[buf_size];
+    std::string buffer(buf_size, '\0');
 
-    std::vsnprintf(buffer, buf_size, fmt, args);
+    std::vsnprintf(buffer.data(), buf_size, fmt, args_copy);
+    va_end(args_copy);
     va_end(args);
 
-    auto ret = T(buffer);
-    delete[] buffer;
-
-    return ret;
+    buffer.pop_back();
+    return T(buffer);
 }
 
 std::string last_system_error();
 
 
+// FNV-1a, same result on every machine and every run (unlike std::hash).
+std::uint64_t stable_hash(std::string_view str);
+
+
 class windows_utf8_in_console {
 public:
     windows_utf8_in_console();
@@ -1,6 +1,9 @@
 #include <cassert>
 
 #include "zip_archive.hpp"
+#include "string_helper.hpp"
+#include "metrics.hpp"
+#include "zip_http_stream.hpp"
 
 #include "mz.h"
 #include "mz_zip.h"
@@ -11,30 +14,71 @@
 
 
 zip_archive::~zip_archive() {
-    if(is_open()) {
+    close();
+}
+
+
+void zip_archive::open(std::filesystem::path file_path) {
+    close();
+    zip_handle = mz_zip_reader_create();
+
+    if(mz_zip_reader_open_file(zip_handle, file_path.string().c_str()) != MZ_OK) {
         close();
+        throw std::runtime_error("Failed to open zip file.");
     }
 }
 
+void zip_archive::open_central_directory(const std::vector<std::uint8_t>& central_directory) {
+    close();
+    zip_handle = mz_zip_reader_create();
 
-void zip_archive::open(std::filesystem::path file_path) {
-    if(is_open()) {
+    // Minizip copies the buffer.
+    if(mz_zip_reader_open_buffer(zip_handle, const_cast<std::uint8_t*>(central_directory.data()), static_cast<std::int32_t>(central_directory.size()), 1) != MZ_OK) {
         close();
+        throw std::runtime_error("Failed to open zip file central directory.");
     }
 
+    metrics::add(metrics::counter::bytes_read, central_directory.size());
+}
+
+void zip_archive::open_url(const std::string& url) {
+    close();
     zip_handle = mz_zip_reader_create();
+    url_stream = zip_http_stream_create();
 
-    if(mz_zip_reader_open_file(zip_handle, file_path.string().c_str()) != MZ_OK) {
-        throw std::exception("Failed to open zip file.");
+    if(mz_stream_open(url_stream, url.c_str(), MZ_OPEN_MODE_READ) != MZ_OK) {
+        auto error = zip_http_stream_error(url_stream);
+        close();
+        throw create_except<std::runtime_error>("Failed to open '%s': %s", url.c_str(), error.c_str());
     }
+
+    if(mz_zip_reader_open(zip_handle, url_stream) != MZ_OK) {
+        auto error = zip_http_stream_error(url_stream);
+        close();
+        throw create_except<std::runtime_error>("Failed to open zip file '%s'. %s", url.c_str(), error.c_str());
+    }
+}
+
+std::uint64_t zip_archive::url_size() {
+    return url_stream ? zip_http_stream_size(url_stream) : 0;
+}
+
+std::uint64_t zip_archive::url_downloaded() {
+    return url_stream ? zip_http_stream_downloaded(url_stream) : 0;
 }
 
+// Also after a failed open, reader and stream are created before opening.
 void zip_archive::close() {
-    if(!is_open()) {
-        return;
+    if(zip_handle) {
+        mz_zip_reader_close(zip_handle);
+        mz_zip_reader_delete(&zip_handle);
     }
 
-    mz_zip_reader_close(zip_handle);
+    // Reader doesnt own streams passed to it.
+    if(url_stream) {
+        mz_stream_close(url_stream);
+        mz_stream_delete(&url_stream);
+    }
 }
 
 
@@ -45,7 +89,14 @@ void zip_archive::extract(std::filesystem::path extract_path) {
     }
 
     if(mz_zip_reader_save_all(zip_handle, extract_path.string().c_str()) != MZ_OK) {
-        throw std::exception("Failed to extract zip file.");
+        throw std::runtime_error("Failed to extract zip file.");
+    }
+
+    if(metrics::enabled.load(std::memory_order_relaxed)) {
+        for (auto &&e : get_file_entries()) {
+            metrics::add(metrics::counter::bytes_read, e.compressed_size);
+            metrics::add(metrics::counter::bytes_inflated, e.uncompressed_size);
+        }
     }
 }
 #else
@@ -56,7 +107,7 @@ void zip_archive::extract(std::filesystem::path extract_path) {
 
 
 bool zip_archive::is_open() {
-    return mz_zip_reader_is_open(zip_handle) == MZ_OK;
+    return zip_handle && mz_zip_reader_is_open(zip_handle) == MZ_OK;
 }
 
 
@@ -76,7 +127,7 @@ std::vector<zip_archive_entry> zip_archive::get_entries() {
                 break;
             }
 
-            enties.push_back({file_info->filename, file_info->modified_date});
+            enties.push_back({file_info->filename, file_info->modified_date, file_info->crc, file_info->compressed_size, file_info->uncompressed_size});
         } while (mz_zip_reader_goto_next_entry(zip_handle) == MZ_OK);
     }
 
@@ -102,18 +153,34 @@ std::vector<zip_archive_entry> zip_archive::get_file_entries() {
                 continue;
             }
 
-            enties.push_back({file_info->filename, file_info->modified_date});
+            enties.push_back({file_info->filename, file_info->modified_date, file_info->crc, file_info->compressed_size, file_info->uncompressed_size});
         } while (mz_zip_reader_goto_next_entry(zip_handle) == MZ_OK);
     }
 
     return enties;
 }
 
-std::vector<std::filesystem::path> zip_archive::list_files() {
-    std::vector<std::filesystem::path> files = {};
+path_table zip_archive::list_files() {
+    return list_files(nullptr);
+}
+
+path_table zip_archive::list_files(std::vector<zip_file_stat>* stats) {
+    path_table files;
+
+    for_each_file([&](std::string_view filepath, const zip_file_stat& stat) {
+        files.push_back(filepath);
+
+        if(stats) {
+            stats->push_back(stat);
+        }
+    });
+
+    return files;
+}
 
+void zip_archive::for_each_file(const std::function<void(std::string_view filepath, const zip_file_stat& stat)>& visitor) {
     if(!is_open()) {
-        return files;
+        return;
     }
 
     mz_zip_file* file_info = nullptr;
@@ -128,9 +195,40 @@ std::vector<std::filesystem::path> zip_archive::list_files() {
                 continue;
             }
 
-            files.push_back(file_info->filename);
+            visitor(file_info->filename, {file_info->modified_date, file_info->compressed_size, file_info->uncompressed_size, file_info->crc});
         } while (mz_zip_reader_goto_next_entry(zip_handle) == MZ_OK);
     }
+}
 
-    return files;
-}
\ No newline at end of file
+
+std::vector<std::uint8_t> zip_archive::read_entry(const std::string& filepath) {
+    if(!is_open()) {
+        throw std::logic_error("Failed to read zip entry: File is not open.");
+    }
+
+    if(mz_zip_reader_locate_entry(zip_handle, filepath.c_str(), 0) != MZ_OK) {
+        throw create_except<std::runtime_error>("Failed to find '%s' in zip file.", filepath.c_str());
+    }
+
+    std::int32_t size = mz_zip_reader_entry_save_buffer_length(zip_handle);
+    if(size < 0) {
+        throw create_except<std::runtime_error>("Failed to read '%s' from zip file: Bad entry size.", filepath.c_str());
+    }
+
+    std::vector<std::uint8_t> buffer(size);
+    if(mz_zip_reader_entry_save_buffer(zip_handle, buffer.data(), size) != MZ_OK) {
+        auto error = url_stream ? zip_http_stream_error(url_stream) : "";
+        throw create_except<std::runtime_error>("Failed to read '%s' from zip file. %s", filepath.c_str(), error.c_str());
+    }
+
+    mz_zip_file* file_info = nullptr;
+    if(metrics::enabled.load(std::memory_order_relaxed) && mz_zip_reader_entry_get_info(zip_handle, &file_info) == MZ_OK) {
+        // Downloads are counted by http_file.
+        if(!url_stream) {
+            metrics::add(metrics::counter::bytes_read, file_info->compressed_size);
+        }
+        metrics::add(metrics::counter::bytes_inflated, size);
+    }
+
+    return buffer;
+}
@@ -1,6 +1,14 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <ctime>
+
+#include "path_table.hpp"
 
 // Fancy minizip abstraction
 
@@ -9,6 +17,18 @@
 struct zip_archive_entry {
     std::filesystem::path filepath;
     std::time_t modified_date;
+    std::uint32_t crc;
+    std::int64_t compressed_size;
+    std::int64_t uncompressed_size;
+};
+
+
+// Central directory infos of a file, no decompression needed.
+struct zip_file_stat {
+    std::time_t modified_date;
+    std::int64_t compressed_size;
+    std::int64_t uncompressed_size;
+    std::uint32_t crc;
 };
 
 
@@ -17,7 +37,21 @@ public:
     zip_archive() = default;
     ~zip_archive();
 
+    // Owns the minizip reader.
+    zip_archive(const zip_archive&) = delete;
+    zip_archive& operator=(const zip_archive&) = delete;
+
     void open(std::filesystem::path file_path);
+
+    // Open central directory read by zip_prefetcher, listing works but extract() needs open().
+    void open_central_directory(const std::vector<std::uint8_t>& central_directory);
+
+    // Zip file on a http server, only central directory and entries that are read get downloaded.
+    void open_url(const std::string& url);
+    // Size of the remote file and how much of it was downloaded, 0 when not opened with open_url().
+    std::uint64_t url_size();
+    std::uint64_t url_downloaded();
+
     void close();
     void extract(std::filesystem::path extract_path);
 
@@ -25,9 +59,20 @@ public:
 
     std::vector<zip_archive_entry> get_entries();
     std::vector<zip_archive_entry> get_file_entries();
-    std::vector<std::filesystem::path> list_files();
+    path_table list_files();
+
+    // Same as list_files() and in the same pass fills stats of every file (same order).
+    path_table list_files(std::vector<zip_file_stat>* stats);
+
+    // Calls visitor for every file (not directories) in central directory order, filepath is only valid during the call.
+    // Nothing is collected, memory doesnt grow with number of files. Zip64 sizes and entry counts are read by minizip.
+    void for_each_file(const std::function<void(std::string_view filepath, const zip_file_stat& stat)>& visitor);
+
+    // Decompress one entry to memory.
+    std::vector<std::uint8_t> read_entry(const std::string& filepath);
 
 private:
     // zero init
     void* zip_handle = 0;
+    void* url_stream = 0;
 };
\ No newline at end of file
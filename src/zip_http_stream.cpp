@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "zip_http_stream.hpp"
+#include "http_file.hpp"
+
+#include "mz.h"
+#include "mz_strm.h"
+
+
+
+
+// End of central directory with a 64KiB comment wont fit, minizip just reads more then.
+static constexpr std::uint64_t tail_size = 16 * 1024;
+static constexpr std::uint64_t read_ahead = 64 * 1024;
+
+
+namespace {
+    struct cached_range {
+        std::uint64_t offset;
+        std::vector<std::uint8_t> data;
+    };
+
+    struct http_stream {
+        mz_stream stream;                   // Has to be first, minizip casts to it
+        std::unique_ptr<http_file> file;
+        std::int64_t position = 0;
+        std::vector<cached_range> cache;
+        std::string error;
+    };
+}
+
+
+static int32_t http_stream_open(void* stream, const char* path, int32_t mode) {
+    auto s = static_cast<http_stream*>(stream);
+
+    if(mode & MZ_OPEN_MODE_WRITE) {
+        return MZ_SUPPORT_ERROR;
+    }
+
+    try {
+        s->file = std::make_unique<http_file>(path);
+        auto tail = s->file->read_tail(tail_size);
+        s->cache.push_back({s->file->size() - tail.size(), std::move(tail)});
+        s->position = 0;
+    }
+    catch(const std::exception& e) {
+        s->error = e.what();
+        s->file.reset();
+        return MZ_OPEN_ERROR;
+    }
+
+    return MZ_OK;
+}
+
+static int32_t http_stream_is_open(void* stream) {
+    return static_cast<http_stream*>(stream)->file ? MZ_OK : MZ_OPEN_ERROR;
+}
+
+static int32_t http_stream_read(void* stream, void* buf, int32_t size) {
+    auto s = static_cast<http_stream*>(stream);
+    auto out = static_cast<std::uint8_t*>(buf);
+    int32_t read = 0;
+
+    if(!s->file) {
+        return MZ_OPEN_ERROR;
+    }
+
+    while(read < size) {
+        auto position = static_cast<std::uint64_t>(s->position);
+        auto cached = std::find_if(s->cache.begin(), s->cache.end(), [&](const cached_range& r) {
+            return position >= r.offset && position < r.offset + r.data.size();
+        });
+
+        if(cached == s->cache.end()) {
+            try {
+                auto data = s->file->read(position, std::max<std::uint64_t>(size - read, read_ahead));
+                if(data.empty()) {
+                    break;      // End of file
+                }
+                s->cache.push_back({position, std::move(data)});
+                cached = s->cache.end() - 1;
+            }
+            catch(const std::exception& e) {
+                s->error = e.what();
+                return MZ_READ_ERROR;
+            }
+        }
+
+        auto available = cached->offset + cached->data.size() - position;
+        auto n = static_cast<int32_t>(std::min<std::uint64_t>(available, size - read));
+        std::memcpy(out + read, cached->data.data() + (position - cached->offset), n);
+        read += n;
+        s->position += n;
+    }
+
+    return read;
+}
+
+static int32_t http_stream_write(void* stream, const void* buf, int32_t size) {
+    return MZ_SUPPORT_ERROR;
+}
+
+static int64_t http_stream_tell(void* stream) {
+    return static_cast<http_stream*>(stream)->position;
+}
+
+static int32_t http_stream_seek(void* stream, int64_t offset, int32_t origin) {
+    auto s = static_cast<http_stream*>(stream);
+
+    if(!s->file) {
+        return MZ_OPEN_ERROR;
+    }
+
+    switch (origin) {
+    case MZ_SEEK_SET:
+        break;
+    case MZ_SEEK_CUR:
+        offset += s->position;
+        break;
+    case MZ_SEEK_END:
+        offset += static_cast<int64_t>(s->file->size());
+        break;
+    default:
+        return MZ_SEEK_ERROR;
+    }
+
+    if(offset < 0) {
+        return MZ_SEEK_ERROR;
+    }
+
+    s->position = offset;
+    return MZ_OK;
+}
+
+static int32_t http_stream_close(void* stream) {
+    auto s = static_cast<http_stream*>(stream);
+    s->cache.clear();
+    return MZ_OK;
+}
+
+static int32_t http_stream_error(void* stream) {
+    return static_cast<http_stream*>(stream)->error.empty() ? MZ_OK : MZ_STREAM_ERROR;
+}
+
+static void* http_stream_create_cb();
+
+static void http_stream_destroy(void** stream) {
+    if(stream) {
+        delete static_cast<http_stream*>(*stream);
+        *stream = nullptr;
+    }
+}
+
+static int32_t http_stream_get_prop_int64(void* stream, int32_t prop, int64_t* value) {
+    return MZ_EXIST_ERROR;
+}
+
+static int32_t http_stream_set_prop_int64(void* stream, int32_t prop, int64_t value) {
+    return MZ_EXIST_ERROR;
+}
+
+
+static mz_stream_vtbl http_stream_vtbl = {
+    http_stream_open,
+    http_stream_is_open,
+    http_stream_read,
+    http_stream_write,
+    http_stream_tell,
+    http_stream_seek,
+    http_stream_close,
+    http_stream_error,
+    http_stream_create_cb,
+    http_stream_destroy,
+    http_stream_get_prop_int64,
+    http_stream_set_prop_int64,
+};
+
+static void* http_stream_create_cb() {
+    auto s = new http_stream();
+    s->stream.vtbl = &http_stream_vtbl;
+    return s;
+}
+
+
+void* zip_http_stream_create() {
+    return http_stream_create_cb();
+}
+
+std::uint64_t zip_http_stream_size(void* stream) {
+    auto s = static_cast<http_stream*>(stream);
+    return s->file ? s->file->size() : 0;
+}
+
+std::uint64_t zip_http_stream_downloaded(void* stream) {
+    auto s = static_cast<http_stream*>(stream);
+    return s->file ? s->file->bytes_downloaded() : 0;
+}
+
+std::string zip_http_stream_error(void* stream) {
+    return static_cast<http_stream*>(stream)->error;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Minizip stream over http_file, for mz_zip_reader_open(). Open it with mz_stream_open(stream, url, MZ_OPEN_MODE_READ).
+// End of the file is read on open, in most zip files it has the whole central directory,
+// anything else is read on demand with some read ahead and kept.
+
+
+
+void* zip_http_stream_create();
+
+std::uint64_t zip_http_stream_size(void* stream);
+std::uint64_t zip_http_stream_downloaded(void* stream);
+
+// What went wrong, minizip only passes error codes around.
+std::string zip_http_stream_error(void* stream);
@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "zip_prefetch.hpp"
+#include "string_helper.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define CEM_TOOL_IO_URING
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+
+
+// End of central directory is at most 64KiB of comment + 22 bytes from the end, zip64 records are right before it.
+static constexpr std::uint64_t max_tail_size = 0xffff + 22 + 20 + 56;
+
+
+static std::uint16_t read_u16(const std::uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static std::uint32_t read_u32(const std::uint8_t* p) {
+    return read_u16(p) | static_cast<std::uint32_t>(read_u16(p + 2)) << 16;
+}
+
+static std::uint64_t read_u64(const std::uint8_t* p) {
+    return read_u32(p) | static_cast<std::uint64_t>(read_u32(p + 4)) << 32;
+}
+
+static void write_u16(std::uint8_t* p, std::uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void write_u32(std::uint8_t* p, std::uint32_t v) {
+    write_u16(p, v & 0xffff);
+    write_u16(p + 2, v >> 16);
+}
+
+static void write_u64(std::uint8_t* p, std::uint64_t v) {
+    write_u32(p, v & 0xffffffff);
+    write_u32(p + 4, v >> 32);
+}
+
+
+namespace {
+    struct central_directory_location {
+        std::uint64_t position;
+        std::uint64_t size;
+        std::vector<std::uint8_t> end_records;      // Go after the central directory, offsets already point to 0.
+    };
+}
+
+// Find end records in the last bytes of the file.
+// Central directory position is taken from the end record position and not the stored offset,
+// same as minizip does for zip files with data in front of them.
+static central_directory_location parse_tail(const std::vector<std::uint8_t>& tail, std::uint64_t file_size) {
+    std::uint64_t tail_start = file_size - tail.size();
+
+    if(tail.size() < 22) {
+        throw std::runtime_error("File is too small to be a zip file.");
+    }
+
+    size_t eocd = tail.size() - 22 + 1;
+    do {
+        eocd--;
+        if(read_u32(&tail[eocd]) == 0x06054b50 && eocd + 22 + read_u16(&tail[eocd + 20]) <= tail.size()) {
+            break;
+        }
+    } while(eocd > 0);
+
+    if(read_u32(&tail[eocd]) != 0x06054b50) {
+        throw std::runtime_error("End of central directory not found.");
+    }
+
+    central_directory_location ret = {};
+
+    if(eocd >= 20 && read_u32(&tail[eocd - 20]) == 0x07064b50) {
+        // Zip64
+        std::uint64_t zip64_eocd = read_u64(&tail[eocd - 20 + 8]);
+
+        if(zip64_eocd < tail_start || zip64_eocd + 56 > tail_start + eocd - 20) {
+            throw std::runtime_error("Zip64 end of central directory is not where expected.");
+        }
+
+        const std::uint8_t* record = &tail[zip64_eocd - tail_start];
+        if(read_u32(record) != 0x06064b50) {
+            throw std::runtime_error("Bad zip64 end of central directory.");
+        }
+
+        ret.size = read_u64(record + 40);
+        if(ret.size > zip64_eocd) {
+            throw std::runtime_error("Bad central directory size.");
+        }
+        ret.position = zip64_eocd - ret.size;
+
+        // Zip64 end record without extensible data, locator and end record.
+        ret.end_records.assign(record, record + 56);
+        write_u64(&ret.end_records[4], 44);
+        write_u64(&ret.end_records[48], 0);
+
+        std::uint8_t locator[20];
+        write_u32(locator, 0x07064b50);
+        write_u32(locator + 4, 0);
+        write_u64(locator + 8, ret.size);
+        write_u32(locator + 16, 1);
+        ret.end_records.insert(ret.end_records.end(), locator, locator + sizeof(locator));
+    } else {
+        ret.size = read_u32(&tail[eocd + 12]);
+        if(ret.size > tail_start + eocd) {
+            throw std::runtime_error("Bad central directory size.");
+        }
+        ret.position = tail_start + eocd - ret.size;
+    }
+
+    size_t end_record = ret.end_records.size();
+    ret.end_records.insert(ret.end_records.end(), &tail[eocd], &tail[eocd] + 22);
+
+    if(read_u32(&ret.end_records[end_record + 16]) != 0xffffffff) {
+        write_u32(&ret.end_records[end_record + 16], 0);
+    }
+    write_u16(&ret.end_records[end_record + 20], 0);       // No comment
+
+    return ret;
+}
+
+static std::vector<std::uint8_t> build_central_directory(const std::uint8_t* central_directory, const central_directory_location& location) {
+    std::vector<std::uint8_t> ret(central_directory, central_directory + location.size);
+    ret.insert(ret.end(), location.end_records.begin(), location.end_records.end());
+    return ret;
+}
+
+
+// Blocking version used by threads.
+static zip_central_directory read_central_directory(const std::filesystem::path& file_path) {
+    zip_central_directory ret = {file_path};
+
+    try {
+        std::ifstream file(file_path, std::ios::binary);
+        if(!file) {
+            throw std::runtime_error("Failed to open file.");
+        }
+
+        std::uint64_t file_size = std::filesystem::file_size(file_path);
+        std::vector<std::uint8_t> tail(std::min(file_size, max_tail_size));
+
+        file.seekg(file_size - tail.size());
+        file.read(reinterpret_cast<char*>(tail.data()), tail.size());
+
+        auto location = parse_tail(tail, file_size);
+        std::uint64_t tail_start = file_size - tail.size();
+
+        if(location.position >= tail_start) {
+            ret.data = build_central_directory(&tail[location.position - tail_start], location);
+        } else {
+            std::vector<std::uint8_t> central_directory(location.size);
+            file.seekg(location.position);
+            file.read(reinterpret_cast<char*>(central_directory.data()), central_directory.size());
+            ret.data = build_central_directory(central_directory.data(), location);
+        }
+
+        if(!file) {
+            throw std::runtime_error("Failed to read file.");
+        }
+    }
+    catch(const std::exception& e) {
+        ret.data.clear();
+        ret.error = e.what();
+    }
+
+    return ret;
+}
+
+
+
+#ifdef CEM_TOOL_IO_URING
+// Just enough io_uring without liburing: readv requests, one in flight per zip file.
+struct zip_prefetcher::uring {
+    struct request {
+        bool used = false;
+        int fd = -1;
+        zip_central_directory result;
+        std::uint64_t file_size;
+        std::uint64_t buffer_offset;        // File offset of buffer[0]
+        std::vector<std::uint8_t> buffer;
+        size_t done;
+        bool reading_tail;
+        central_directory_location location;
+        iovec iov;
+    };
+
+    int ring_fd = -1;
+    std::uint8_t* sq_ptr = nullptr;
+    size_t sq_size = 0;
+    std::uint8_t* cq_ptr = nullptr;
+    size_t cq_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    unsigned to_submit = 0;
+    size_t in_flight = 0;
+    std::vector<request> requests;
+    std::deque<zip_central_directory> ready;
+
+    bool setup(unsigned entries) {
+        io_uring_params params = {};
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if(ring_fd < 0) {
+            return false;   // Old kernel or blocked by seccomp, threads will do.
+        }
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if(params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        void* sq = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if(sq == MAP_FAILED) {
+            return false;
+        }
+        sq_ptr = static_cast<std::uint8_t*>(sq);
+
+        if(params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ptr = sq_ptr;
+        } else {
+            void* cq = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if(cq == MAP_FAILED) {
+                return false;
+            }
+            cq_ptr = static_cast<std::uint8_t*>(cq);
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if(s == MAP_FAILED) {
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(s);
+
+        sq_tail = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq_ptr + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq_ptr + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq_ptr + params.cq_off.cqes);
+
+        requests.resize(params.sq_entries);
+        return true;
+    }
+
+    ~uring() {
+        // Kernel may still write to request buffers, wait for everything first.
+        while(in_flight && wait()) {}
+
+        for (auto &&r : requests) {
+            if(r.fd >= 0) {
+                close(r.fd);
+            }
+        }
+
+        if(sqes) {
+            munmap(sqes, sqes_size);
+        }
+        if(cq_ptr && cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        if(sq_ptr) {
+            munmap(sq_ptr, sq_size);
+        }
+        if(ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+    bool has_free_request() {
+        return in_flight < requests.size();
+    }
+
+    void start(const std::filesystem::path& file_path) {
+        auto it = std::find_if(requests.begin(), requests.end(), [](const request& r) {
+            return !r.used;
+        });
+
+        auto &&r = *it;
+        r.result = {file_path};
+
+        r.fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat file_stat;
+
+        if(r.fd < 0 || fstat(r.fd, &file_stat) != 0) {
+            r.result.error = last_system_error();
+            finish(r);
+            return;
+        }
+
+        r.used = true;
+        in_flight++;
+
+        r.file_size = file_stat.st_size;
+        r.buffer.resize(std::min(r.file_size, max_tail_size));
+        r.buffer_offset = r.file_size - r.buffer.size();
+        r.done = 0;
+        r.reading_tail = true;
+        submit_read(r);
+    }
+
+    void submit_read(request& r) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+
+        r.iov.iov_base = r.buffer.data() + r.done;
+        r.iov.iov_len = r.buffer.size() - r.done;
+
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = r.fd;
+        sqe->addr = reinterpret_cast<std::uint64_t>(&r.iov);
+        sqe->len = 1;
+        sqe->off = r.buffer_offset + r.done;
+        sqe->user_data = &r - requests.data();
+
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        to_submit++;
+    }
+
+    void finish(request& r) {
+        if(r.fd >= 0) {
+            close(r.fd);
+            r.fd = -1;
+        }
+
+        if(r.used) {
+            r.used = false;
+            in_flight--;
+        }
+
+        r.buffer = {};
+        r.location = {};
+        ready.push_back(std::move(r.result));
+    }
+
+    void complete(request& r, int result) {
+        if(result <= 0) {
+            r.result.error = result < 0 ? std::strerror(-result) : "Unexpected end of file.";
+            finish(r);
+            return;
+        }
+
+        r.done += result;
+        if(r.done < r.buffer.size()) {
+            submit_read(r);         // Short read
+            return;
+        }
+
+        try {
+            if(r.reading_tail) {
+                r.location = parse_tail(r.buffer, r.file_size);
+
+                // Small zip files already have the central directory in the tail.
+                if(r.location.position >= r.buffer_offset) {
+                    r.result.data = build_central_directory(&r.buffer[r.location.position - r.buffer_offset], r.location);
+                    finish(r);
+                    return;
+                }
+
+                r.reading_tail = false;
+                r.buffer.assign(r.location.size, 0);
+                r.buffer_offset = r.location.position;
+                r.done = 0;
+                submit_read(r);
+                return;
+            }
+
+            r.result.data = build_central_directory(r.buffer.data(), r.location);
+        }
+        catch(const std::exception& e) {
+            r.result.error = e.what();
+        }
+
+        finish(r);
+    }
+
+    // Submit queued reads, wait for at least one and handle all completions.
+    bool wait() {
+        int submitted = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+
+        if(submitted < 0) {
+            if(errno == EINTR) {
+                return true;
+            }
+
+            // Ring is broken, give up on everything in flight, zip_archive::open() will read them normally.
+            auto error = last_system_error();
+            for (auto &&r : requests) {
+                if(r.used) {
+                    r.result.error = error;
+                    finish(r);
+                }
+            }
+            return false;
+        }
+
+        to_submit -= submitted;
+
+        unsigned head = *cq_head;
+        while(head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe* cqe = &cqes[head & *cq_mask];
+            complete(requests[cqe->user_data], cqe->res);
+            head++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        return true;
+    }
+};
+#else
+struct zip_prefetcher::uring {};
+#endif
+
+
+
+zip_prefetcher::zip_prefetcher(const std::vector<std::filesystem::path>& file_paths, unsigned queue_depth) : file_paths(file_paths), queue_depth(std::max(queue_depth, 1u)) {
+#ifdef CEM_TOOL_IO_URING
+    ring = new uring();
+    if(ring->setup(this->queue_depth)) {
+        return;
+    }
+    delete ring;
+    ring = nullptr;
+#endif
+
+    start_workers();
+}
+
+zip_prefetcher::~zip_prefetcher() {
+    {
+        std::lock_guard lock(ready_mutex);
+        stopping = true;
+    }
+    ready_cv.notify_all();
+
+    for (auto &&w : workers) {
+        w.join();
+    }
+
+    delete ring;
+}
+
+
+size_t zip_prefetcher::backlog() {
+#ifdef CEM_TOOL_IO_URING
+    if(ring) {
+        return ring->ready.size();
+    }
+#endif
+
+    std::lock_guard lock(ready_mutex);
+    return ready.size();
+}
+
+
+bool zip_prefetcher::next(zip_central_directory* central_directory) {
+    if(ring) {
+        return uring_next(central_directory);
+    }
+
+    std::unique_lock lock(ready_mutex);
+    ready_cv.wait(lock, [&]() {
+        return !ready.empty() || returned == file_paths.size();
+    });
+
+    if(ready.empty()) {
+        return false;
+    }
+
+    *central_directory = std::move(ready.front());
+    ready.pop_front();
+    returned++;
+
+    lock.unlock();
+    ready_cv.notify_all();
+    return true;
+}
+
+
+// Threads only wait on io, no need to match cpu count.
+void zip_prefetcher::start_workers() {
+    unsigned worker_count = static_cast<unsigned>(std::min<size_t>(std::min(queue_depth, 16u), file_paths.size() - next_file));
+    for (unsigned i = 0; i < worker_count; i++) {
+        workers.emplace_back(&zip_prefetcher::worker, this);
+    }
+}
+
+void zip_prefetcher::worker() {
+    while(true) {
+        std::filesystem::path file_path;
+        {
+            std::unique_lock lock(ready_mutex);
+
+            // Dont read too far ahead of whoever is using the results.
+            ready_cv.wait(lock, [&]() {
+                return stopping || ready.size() < queue_depth;
+            });
+
+            if(stopping || next_file == file_paths.size()) {
+                return;
+            }
+
+            file_path = file_paths[next_file++];
+        }
+
+        auto result = read_central_directory(file_path);
+
+        {
+            std::lock_guard lock(ready_mutex);
+            ready.push_back(std::move(result));
+        }
+        ready_cv.notify_all();
+    }
+}
+
+
+#ifdef CEM_TOOL_IO_URING
+bool zip_prefetcher::uring_next(zip_central_directory* central_directory) {
+    while(true) {
+        if(!ring->ready.empty()) {
+            *central_directory = std::move(ring->ready.front());
+            ring->ready.pop_front();
+            returned++;
+            return true;
+        }
+
+        if(returned == file_paths.size()) {
+            return false;
+        }
+
+        while(next_file < file_paths.size() && ring->has_free_request()) {
+            ring->start(file_paths[next_file++]);
+        }
+
+        if(ring->in_flight && !ring->wait()) {
+            // Broken ring stays broken, threads read the rest. Failed reads are read again by zip_archive::open().
+            {
+                std::lock_guard lock(ready_mutex);
+                ready = std::move(ring->ready);
+            }
+            delete ring;
+            ring = nullptr;
+
+            start_workers();
+            return next(central_directory);
+        }
+    }
+}
+#else
+bool zip_prefetcher::uring_next(zip_central_directory* central_directory) {
+    return false;
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Reads end of central directory and central directory of many zip files at once, so batch runs over
+// slow or cold storage dont wait for every small read minizip does one by one.
+// On linux reads are submitted to io_uring, everywhere else (or if io_uring is not available or fails
+// while running) a few threads do blocking reads.
+
+
+
+struct zip_central_directory {
+    std::filesystem::path file_path;
+    std::vector<std::uint8_t> data;         // Central directory and end records, offsets moved to start at 0, see zip_archive::open_central_directory().
+    std::string error;                      // Not empty if reading failed, zip_archive::open() should report the real problem.
+};
+
+
+class zip_prefetcher {
+public:
+    zip_prefetcher(const std::vector<std::filesystem::path>& file_paths, unsigned queue_depth);
+    zip_prefetcher(const zip_prefetcher&) = delete;
+    zip_prefetcher& operator=(const zip_prefetcher&) = delete;
+    ~zip_prefetcher();
+
+    // Blocks until next zip file is read, in order of completion. Returns false when all were returned.
+    bool next(zip_central_directory* central_directory);
+
+    // Central directories already read and waiting for next(), call from the same thread as next() with io_uring.
+    size_t backlog();
+
+private:
+    std::vector<std::filesystem::path> file_paths;
+    unsigned queue_depth;
+    size_t next_file = 0;
+    size_t returned = 0;
+
+    // Threads fallback
+    std::vector<std::thread> workers;
+    std::mutex ready_mutex;
+    std::condition_variable ready_cv;
+    std::deque<zip_central_directory> ready;
+    bool stopping = false;
+
+    void start_workers();
+    void worker();
+
+    // io_uring, defined in cpp
+    struct uring;
+    uring* ring = nullptr;
+
+    bool uring_next(zip_central_directory* central_directory);
+};
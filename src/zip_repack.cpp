@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+
+#include "zip_repack.hpp"
+#include "zip_archive.hpp"
+#include "string_helper.hpp"
+
+#include "zlib.h"
+
+// The archive is written here instead of with minizip, minizip converts times to dos format
+// in local time zone so output would depend on the machine it was created on.
+
+
+
+namespace {
+    struct compressed_entry {
+        std::string filepath;
+        std::uint16_t method;               // 0 = store, 8 = deflate
+        std::uint32_t crc;
+        std::uint64_t uncompressed_size;
+        std::vector<std::uint8_t> data;
+    };
+
+    class le_writer {
+    public:
+        std::vector<std::uint8_t> bytes;
+
+        void u16(std::uint16_t v) {
+            bytes.push_back(v & 0xff);
+            bytes.push_back(v >> 8);
+        }
+
+        void u32(std::uint32_t v) {
+            u16(v & 0xffff);
+            u16(v >> 16);
+        }
+
+        void u64(std::uint64_t v) {
+            u32(v & 0xffffffff);
+            u32(v >> 32);
+        }
+
+        void str(const std::string& s) {
+            bytes.insert(bytes.end(), s.begin(), s.end());
+        }
+    };
+}
+
+
+static void deflate_entry(compressed_entry* entry, const std::vector<std::uint8_t>& data, int compress_level) {
+    entry->uncompressed_size = data.size();
+    entry->crc = crc32(crc32(0, nullptr, 0), data.data(), static_cast<uInt>(data.size()));
+    entry->method = 0;
+
+    if(compress_level > 0 && !data.empty()) {
+        z_stream stream = {};
+
+        // Negative window bits = raw deflate without zlib header, what zip files use.
+        if(deflateInit2(&stream, compress_level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw create_except<std::runtime_error>("Failed to compress '%s': deflateInit2 failed.", entry->filepath.c_str());
+        }
+
+        std::vector<std::uint8_t> compressed(deflateBound(&stream, static_cast<uLong>(data.size())));
+        stream.next_in = const_cast<Bytef*>(data.data());
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = compressed.data();
+        stream.avail_out = static_cast<uInt>(compressed.size());
+
+        int status = deflate(&stream, Z_FINISH);
+        compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+
+        if(status != Z_STREAM_END) {
+            throw create_except<std::runtime_error>("Failed to compress '%s': deflate failed (%d).", entry->filepath.c_str(), status);
+        }
+
+        if(compressed.size() < data.size()) {
+            entry->method = 8;
+            entry->data = std::move(compressed);
+            return;
+        }
+    }
+
+    entry->data = data;
+}
+
+
+// Dos time in UTC, the ntfs extra field has the exact time anyway.
+static void dos_date_time(std::time_t t, std::uint16_t* dos_date, std::uint16_t* dos_time) {
+    std::tm utc = {};
+#ifdef _WIN32
+    gmtime_s(&utc, &t);
+#else
+    gmtime_r(&t, &utc);
+#endif
+
+    if(utc.tm_year < 80) {
+        *dos_date = (1 << 5) | 1;       // 1980-01-01
+        *dos_time = 0;
+        return;
+    }
+
+    *dos_date = static_cast<std::uint16_t>(((utc.tm_year - 80) << 9) | ((utc.tm_mon + 1) << 5) | utc.tm_mday);
+    *dos_time = static_cast<std::uint16_t>((utc.tm_hour << 11) | (utc.tm_min << 5) | (utc.tm_sec / 2));
+}
+
+// NTFS extra field (0x000a) with modification, access and creation time, minizip reads it back with full precision.
+static void ntfs_extra_field(le_writer* w, std::time_t t) {
+    std::uint64_t filetime = (static_cast<std::uint64_t>(t) + 11644473600ull) * 10000000ull;
+
+    w->u16(0x000a);
+    w->u16(32);
+    w->u32(0);          // reserved
+    w->u16(1);          // attribute tag: times
+    w->u16(24);
+    w->u64(filetime);
+    w->u64(filetime);
+    w->u64(filetime);
+}
+
+
+std::vector<zip_repack_entry> zip_repack(const std::filesystem::path& input_path, const std::filesystem::path& output_path, int compress_level, unsigned jobs) {
+    std::vector<zip_archive_entry> entries;
+    {
+        zip_archive input;
+        input.open(input_path);
+        entries = input.get_file_entries();
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const zip_archive_entry& a, const zip_archive_entry& b) {
+        return a.filepath.string() < b.filepath.string();
+    });
+
+    if(entries.size() >= 0xffff) {
+        throw create_except<std::runtime_error>("Failed to repack '%s': Too many entries.", input_path.string().c_str());
+    }
+
+    std::time_t fixed_time = 0;
+    for (auto &&e : entries) {
+        fixed_time = std::max(fixed_time, e.modified_date);
+    }
+
+    // Every worker reads with its own minizip handle, entries are picked in order from a shared counter.
+    std::vector<compressed_entry> compressed(entries.size());
+    std::atomic<size_t> next_entry = 0;
+    std::vector<std::string> errors(std::max(jobs, 1u));
+    std::vector<std::thread> workers;
+
+    for (unsigned w = 0; w < std::max(jobs, 1u); w++) {
+        workers.emplace_back([&, w]() {
+            try {
+                zip_archive input;
+                input.open(input_path);
+
+                for (size_t i = next_entry++; i < entries.size(); i = next_entry++) {
+                    auto filepath = entries[i].filepath.string();
+                    compressed[i].filepath = filepath;
+                    deflate_entry(&compressed[i], input.read_entry(filepath), compress_level);
+                }
+            }
+            catch(const std::exception& e) {
+                errors[w] = e.what();
+                next_entry = entries.size();
+            }
+        });
+    }
+
+    for (auto &&t : workers) {
+        t.join();
+    }
+
+    for (auto &&e : errors) {
+        if(!e.empty()) {
+            throw std::runtime_error(e);
+        }
+    }
+
+    std::uint16_t dos_date, dos_time;
+    dos_date_time(fixed_time, &dos_date, &dos_time);
+
+    std::ofstream output(output_path, std::ios::binary);
+    if(!output) {
+        throw create_except<std::runtime_error>("Failed to create '%s'.", output_path.string().c_str());
+    }
+
+    le_writer central_directory;
+    std::uint64_t offset = 0;
+    std::vector<zip_repack_entry> ret;
+
+    for (auto &&e : compressed) {
+        if(e.data.size() >= 0xffffffff || e.uncompressed_size >= 0xffffffff || offset >= 0xffffffff) {
+            throw create_except<std::runtime_error>("Failed to repack '%s': Archive is too big.", input_path.string().c_str());
+        }
+
+        std::uint16_t version_needed = e.method == 8 ? 20 : 10;
+        std::uint16_t flags = 1 << 11;      // utf8 names
+
+        le_writer extra;
+        ntfs_extra_field(&extra, fixed_time);
+
+        le_writer local;
+        local.u32(0x04034b50);
+        local.u16(version_needed);
+        local.u16(flags);
+        local.u16(e.method);
+        local.u16(dos_time);
+        local.u16(dos_date);
+        local.u32(e.crc);
+        local.u32(static_cast<std::uint32_t>(e.data.size()));
+        local.u32(static_cast<std::uint32_t>(e.uncompressed_size));
+        local.u16(static_cast<std::uint16_t>(e.filepath.size()));
+        local.u16(static_cast<std::uint16_t>(extra.bytes.size()));
+        local.str(e.filepath);
+        local.bytes.insert(local.bytes.end(), extra.bytes.begin(), extra.bytes.end());
+
+        central_directory.u32(0x02014b50);
+        central_directory.u16(20);          // made by: msdos, zip 2.0
+        central_directory.u16(version_needed);
+        central_directory.u16(flags);
+        central_directory.u16(e.method);
+        central_directory.u16(dos_time);
+        central_directory.u16(dos_date);
+        central_directory.u32(e.crc);
+        central_directory.u32(static_cast<std::uint32_t>(e.data.size()));
+        central_directory.u32(static_cast<std::uint32_t>(e.uncompressed_size));
+        central_directory.u16(static_cast<std::uint16_t>(e.filepath.size()));
+        central_directory.u16(static_cast<std::uint16_t>(extra.bytes.size()));
+        central_directory.u16(0);           // comment
+        central_directory.u16(0);           // disk
+        central_directory.u16(0);           // internal attributes
+        central_directory.u32(0);           // external attributes
+        central_directory.u32(static_cast<std::uint32_t>(offset));
+        central_directory.str(e.filepath);
+        central_directory.bytes.insert(central_directory.bytes.end(), extra.bytes.begin(), extra.bytes.end());
+
+        output.write(reinterpret_cast<const char*>(local.bytes.data()), local.bytes.size());
+        output.write(reinterpret_cast<const char*>(e.data.data()), e.data.size());
+        offset += local.bytes.size() + e.data.size();
+
+        ret.push_back({e.filepath, e.uncompressed_size, e.data.size()});
+    }
+
+    if(offset + central_directory.bytes.size() >= 0xffffffff) {
+        throw create_except<std::runtime_error>("Failed to repack '%s': Archive is too big.", input_path.string().c_str());
+    }
+
+    le_writer end_of_central_directory;
+    end_of_central_directory.u32(0x06054b50);
+    end_of_central_directory.u16(0);        // disk
+    end_of_central_directory.u16(0);        // disk with central directory
+    end_of_central_directory.u16(static_cast<std::uint16_t>(compressed.size()));
+    end_of_central_directory.u16(static_cast<std::uint16_t>(compressed.size()));
+    end_of_central_directory.u32(static_cast<std::uint32_t>(central_directory.bytes.size()));
+    end_of_central_directory.u32(static_cast<std::uint32_t>(offset));
+    end_of_central_directory.u16(0);        // comment
+
+    output.write(reinterpret_cast<const char*>(central_directory.bytes.data()), central_directory.bytes.size());
+    output.write(reinterpret_cast<const char*>(end_of_central_directory.bytes.data()), end_of_central_directory.bytes.size());
+
+    if(!output) {
+        throw create_except<std::runtime_error>("Failed to write '%s'.", output_path.string().c_str());
+    }
+
+    return ret;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Rewrites extension zip files in a canonical form:
+// - only file entries, sorted by path
+// - every entry has the newest modification time of the original, so the manifest time stays the same
+// - deflate with one compression level for everything (store if it doesnt get smaller)
+// - fixed header fields, same input always gives the same bytes
+// Entries are decompressed and compressed on multiple threads.
+
+
+
+struct zip_repack_entry {
+    std::string filepath;
+    std::uint64_t uncompressed_size;
+    std::uint64_t compressed_size;
+};
+
+std::vector<zip_repack_entry> zip_repack(const std::filesystem::path& input_path, const std::filesystem::path& output_path, int compress_level, unsigned jobs);
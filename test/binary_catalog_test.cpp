@@ -0,0 +1,167 @@
+// Binary catalog round trip: manifests written with binary_catalog::serialize() and read back through
+// the mapping have to give the same json as the catalog (minus fields the binary format doesnt store).
+//
+//   binary-catalog-test <temp directory>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "binary_catalog.hpp"
+
+#include "nlohmann/json.hpp"
+
+
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::fprintf(stderr, "FAIL: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+
+static fusion::cem_ext_manifest make_manifest(const std::string& mfxname, std::uint32_t platforms, int file_count) {
+    fusion::cem_ext_manifest ext = {};
+    ext.mfxname = mfxname;
+    ext.name = mfxname + " object";
+    ext.author = file_count % 2 ? "Someone" : "";
+    ext.description = "Extension \"" + mfxname + "\"\nwith ünïcode and a\ttab.";
+    ext.website = file_count ? "http://example.com/" + mfxname : "";
+    ext.dev = file_count == 3;
+    ext.platforms = platforms;
+    ext.download = mfxname;
+    ext.time = 1600000000 + file_count;
+    ext.zipsize = 1000u * file_count + 17;
+
+    for (int i = 0; i < file_count; i++) {
+        ext.files.push_back("Extensions/" + mfxname + std::to_string(i) + ".mfx");
+    }
+
+    // Not stored in binary catalogs.
+    ext.footprint = fusion::ext_footprint{};
+    ext.run_infos = fusion::ext_run_summary{0x54534554, 1, 0, 2, 3, 4};
+    return ext;
+}
+
+
+int main(int argc, char** argv) {
+    if(argc != 2) {
+        std::fprintf(stderr, "usage: binary-catalog-test <temp directory>\n");
+        return 2;
+    }
+
+    // Sorted by mfxname like catalog::finalize() leaves them.
+    std::vector<fusion::cem_ext_manifest> manifests = {
+        make_manifest("Alpha", fusion::windows, 0),
+        make_manifest("Beta", fusion::windows | fusion::android | fusion::ios, 1),
+        make_manifest("Delta", fusion::html | fusion::uwp, 3),
+        make_manifest("Gamma", 0, 2),
+        make_manifest("Omega", fusion::platform::last - 1, 5),
+    };
+
+    auto file_path = std::filesystem::path(argv[1]) / "binary-catalog-test.bin";
+    std::filesystem::create_directories(file_path.parent_path());
+
+    try {
+        auto bytes = binary_catalog::serialize(manifests);
+        {
+            std::ofstream output(file_path, std::ios::binary);
+            output.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+
+        binary_catalog written;
+        written.open(file_path);
+        check(written.size() == manifests.size(), "extension count");
+
+        for (size_t i = 0; i < written.size() && i < manifests.size(); i++) {
+            auto expected = manifests[i].to_json_object();
+            expected.erase("footprint");
+            expected.erase("run_infos");
+
+            check(written.to_manifest(i).to_json_object() == expected, "round trip of '" + manifests[i].mfxname + "'");
+            check(written.find(manifests[i].mfxname) == i, "find '" + manifests[i].mfxname + "'");
+        }
+        check(!written.find("Missing"), "find missing extension");
+
+        for (std::uint32_t p = 0; p < 8; p++) {
+            auto platform = fusion::platform_index_to_enum(p);
+            std::vector<std::uint32_t> expected;
+            for (std::uint32_t i = 0; i < manifests.size(); i++) {
+                if(manifests[i].platforms & platform) {
+                    expected.push_back(i);
+                }
+            }
+
+            auto found = written.with_platform(platform);
+            check(std::vector<std::uint32_t>(found.begin(), found.end()) == expected, std::string("with_platform ") + fusion::platform_names[p]);
+        }
+
+        for (auto &&bad : {0u, (std::uint32_t)(fusion::windows | fusion::android), (std::uint32_t)fusion::platform::last}) {
+            bool threw = false;
+            try {
+                written.with_platform(static_cast<fusion::platform>(bad));
+            }
+            catch(const std::runtime_error&) {
+                threw = true;
+            }
+            check(threw, "with_platform rejects " + std::to_string(bad));
+        }
+        written.close();
+
+        // Sections fit in the file but indices in them point outside.
+        auto corrupt_file = [&](const char* what, auto&& corrupt, auto&& use) {
+            auto corrupt_bytes = bytes;
+            binary_catalog_format::header h;
+            std::memcpy(&h, corrupt_bytes.data(), sizeof(h));
+            corrupt(corrupt_bytes.data(), h);
+            {
+                std::ofstream output(file_path, std::ios::binary);
+                output.write(reinterpret_cast<const char*>(corrupt_bytes.data()), corrupt_bytes.size());
+            }
+
+            binary_catalog corrupted;
+            corrupted.open(file_path);
+            bool threw = false;
+            try {
+                use(corrupted);
+            }
+            catch(const std::out_of_range&) {
+                threw = true;
+            }
+            check(threw, std::string("corrupt ") + what + " is out of range");
+        };
+
+        auto record_at = [](std::uint8_t* data, const binary_catalog_format::header& h, size_t index) {
+            return reinterpret_cast<binary_catalog_format::record*>(data + h.records_offset) + index;
+        };
+
+        corrupt_file("first file", [&](std::uint8_t* data, auto&& h) { record_at(data, h, 1)->first_file = 0xfffffff0; },
+                     [](binary_catalog& c) { c.file(1, 0); });
+        corrupt_file("file count", [&](std::uint8_t* data, auto&& h) { record_at(data, h, 4)->file_count = 1000; },
+                     [](binary_catalog& c) { c.to_manifest(4); });
+        corrupt_file("platform range", [&](std::uint8_t* data, auto&& h) { reinterpret_cast<binary_catalog_format::platform_range*>(data + h.platform_index_offset)->count = 0xffffffff; },
+                     [](binary_catalog& c) { c.with_platform(fusion::windows); });
+        corrupt_file("name index", [&](std::uint8_t* data, auto&& h) { reinterpret_cast<std::uint32_t*>(data + h.name_index_offset)[2] = 99; },
+                     [](binary_catalog& c) { c.find("Delta"); });
+    }
+    catch(const std::exception& e) {
+        std::fprintf(stderr, "FAIL: %s\n", e.what());
+        failures++;
+    }
+
+    std::filesystem::remove(file_path);
+
+    if(failures) {
+        std::fprintf(stderr, "%d checks failed.\n", failures);
+        return 1;
+    }
+
+    std::printf("Binary catalog round trip ok.\n");
+    return 0;
+}
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+# 'cem-tool imports' against generated PE32 and PE32+ files.
+# Checks bundled, system, mmfs2 and missing imports (also of bundled dlls) and that truncated or
+# malformed headers are reported as errors instead of crashing.
+#
+#   imports_test.py --cem-tool <exe>
+
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+
+# Smallest dll with one .idata section holding the import descriptors and dll names.
+def pe_file(dlls, pe32_plus=False):
+    names = b""
+    name_offsets = []
+    descriptors_size = 20 * (len(dlls) + 1)
+    for d in dlls:
+        name_offsets.append(descriptors_size + len(names))
+        names += d.encode() + b"\0"
+
+    imports = b"".join(struct.pack("<5I", 0, 0, 0, 0x1000 + o, 0) for o in name_offsets) + bytes(20) + names
+    section = imports + bytes(-len(imports) % 0x200)
+
+    optional_header_size = 240 if pe32_plus else 224
+    optional_header = bytearray(optional_header_size)
+    struct.pack_into("<H", optional_header, 0, 0x20b if pe32_plus else 0x10b)
+    struct.pack_into("<I", optional_header, 60, 0x200)                  # size of headers
+    directories = 112 if pe32_plus else 96
+    struct.pack_into("<I", optional_header, directories - 4, 16)        # data directory count
+    struct.pack_into("<II", optional_header, directories + 8, 0x1000, descriptors_size)     # import directory
+
+    dos_header = b"MZ" + bytes(0x3a) + struct.pack("<I", 0x40)
+    file_header = struct.pack("<HHIIIHH", 0x8664 if pe32_plus else 0x14c, 1, 0, 0, 0, optional_header_size, 0x2102)
+    section_header = struct.pack("<8sIIIIIIHHI", b".idata", len(section), 0x1000, len(section), 0x200, 0, 0, 0, 0, 0xc0000040)
+
+    headers = dos_header + b"PE\0\0" + file_header + bytes(optional_header) + section_header
+    headers += bytes(0x200 - len(headers))
+    return headers + section
+
+
+def write(path, data):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, "wb") as f:
+        f.write(data)
+
+
+def run_imports(args, inputs):
+    result = subprocess.run([args.cem_tool, "imports"] + inputs, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+
+    # Negative = killed by a signal, a bad file must never crash the walker.
+    if result.returncode < 0:
+        sys.exit("cem-tool crashed with signal %d on %s.\n%s" % (-result.returncode, inputs, result.stderr))
+
+    # "    kind     dll  (bundled path)  imported by x"
+    found = {}
+    for line in result.stdout.splitlines():
+        parts = line.split()
+        if line.startswith("    ") and len(parts) >= 2:
+            found[parts[1]] = (parts[0], line)
+
+    return result.returncode, found, result.stderr
+
+
+failures = 0
+
+def check(condition, what):
+    global failures
+    if not condition:
+        print("FAIL: %s" % what)
+        failures += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cem-tool imports test.")
+    parser.add_argument("--cem-tool", required=True, help="cem-tool executable")
+    args = parser.parse_args()
+
+    work_directory = tempfile.mkdtemp(prefix="cem-tool-imports-")
+    try:
+        # Unpacked extension, PE32 mfx with a bundled PE32+ dll that has imports of its own.
+        ext = os.path.join(work_directory, "Test")
+        write(os.path.join(ext, "Extensions", "Test.mfx"), pe_file(["KERNEL32.dll", "mmfs2.dll", "Helper.dll", "Missing.dll"]))
+        write(os.path.join(ext, "Extensions", "Helper.dll"), pe_file(["user32.dll", "Deep.dll", "api-ms-win-crt-runtime-l1-1-0.dll"], pe32_plus=True))
+
+        code, found, stderr = run_imports(args, [ext])
+        expected = {
+            "KERNEL32.dll": "system",
+            "mmfs2.dll": "mmfs2",
+            "Helper.dll": "bundled",
+            "Missing.dll": "missing",
+            "user32.dll": "system",
+            "Deep.dll": "missing",
+            "api-ms-win-crt-runtime-l1-1-0.dll": "system",
+        }
+        for dll, kind in expected.items():
+            check(found.get(dll, ("none",))[0] == kind, "%s should be %s, got %s" % (dll, kind, found.get(dll, ("none",))[0]))
+        check("imported by Extensions/Helper.dll" in found.get("Deep.dll", ("", ""))[1], "Deep.dll should be imported by the bundled dll")
+        check(code != 0, "missing imports should fail")
+
+        # Single PE32+ file, nothing missing.
+        single = os.path.join(work_directory, "single")
+        write(os.path.join(single, "Good.mfx"), pe_file(["kernel32.dll", "Local.dll"], pe32_plus=True))
+        write(os.path.join(single, "Local.dll"), pe_file([]))
+
+        code, found, stderr = run_imports(args, [os.path.join(single, "Good.mfx")])
+        check(found.get("Local.dll", ("none",))[0] == "bundled", "Local.dll next to the mfx should be bundled")
+        check(code == 0, "no missing imports should succeed: %s" % stderr)
+
+        # Bad files are errors, not crashes.
+        good = pe_file(["kernel32.dll"])
+        bad_optional_header = bytearray(good)
+        struct.pack_into("<H", bad_optional_header, 0x40 + 24, 0x999)
+        bad_pe_offset = bytearray(good)
+        struct.pack_into("<I", bad_pe_offset, 0x3c, 0xfffffff0)
+        bad_import_rva = bytearray(good)
+        struct.pack_into("<I", bad_import_rva, 0x40 + 24 + 96 + 8, 0x7fff0000)
+
+        bad_files = {
+            "Empty.mfx": b"",
+            "TruncatedDos.mfx": good[:0x20],
+            "TruncatedHeaders.mfx": good[:0x90],
+            "TruncatedImports.mfx": good[:0x210],
+            "NotPe.mfx": b"MZ" + bytes(0x3a) + struct.pack("<I", 0x40) + b"NE\0\0" + bytes(64),
+            "BadOptionalHeader.mfx": bytes(bad_optional_header),
+            "BadPeOffset.mfx": bytes(bad_pe_offset),
+            "BadImportRva.mfx": bytes(bad_import_rva),
+        }
+
+        for name, data in bad_files.items():
+            directory = os.path.join(work_directory, "bad-" + name)
+            write(os.path.join(directory, name), data)
+            code, found, stderr = run_imports(args, [os.path.join(directory, name)])
+            check(code != 0 and "PE file" in stderr, "%s should be reported as a bad PE file, got exit code %d: %s" % (name, code, stderr.strip()))
+    finally:
+        shutil.rmtree(work_directory, ignore_errors=True)
+
+    if failures:
+        print("%d checks failed." % failures)
+        return 1
+
+    print("Imports ok.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())